@@ -0,0 +1,26 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Linear arena
+ * A large range of address space is reserved up front and backed by memory only as the arena
+ * grows, so allocations are contiguous and never move. Resetting only rewinds the offset:
+ * once the arena has grown to its high-water mark, a frame allocates no memory at all.
+ */
+typedef struct {
+    unsigned char* base;
+    size_t reserved;        // bytes of reserved address space
+    size_t committed;       // bytes backed by memory (stays at the high-water mark)
+    size_t used;            // bytes allocated since the last reset
+    size_t peak;            // largest 'used' value ever reached
+} arena_t;
+
+bool arena_init(arena_t* arena, size_t reserve_size);
+void* arena_push(arena_t* arena, size_t size, size_t alignment);
+void arena_reset(arena_t* arena);
+void arena_release(arena_t* arena);
+
+#endif /* ARENA_H */
@@ -1,14 +1,34 @@
 #ifndef ARRAY_H
 #define ARRAY_H
 
+#include <stddef.h>
+
+/**
+ * Dynamic array
+ * The capacity and the occupied length are stored in a 16-byte header right before the
+ * elements, so the array itself is a plain typed pointer (NULL is a valid empty array).
+ * Capacity grows geometrically, so pushing n elements costs O(n) copies in total.
+ */
 #define array_push(array, value)                                        \
             do {                                                        \
                 (array) = array_hold((array), 1, sizeof(*(array)));     \
                 (array)[array_length(array) - 1] = (value);             \
-            } while (0);                                                \
+            } while (0)
 
-void* array_hold(void* array, int count, int item_size);
-int array_length(void* array);
+void* array_hold(void* array, size_t count, size_t item_size);
+void* array_reserve(void* array, size_t capacity, size_t item_size);
+void* array_shrink_to_fit(void* array, size_t item_size);
+void array_clear(void* array);
+size_t array_length(void* array);
+size_t array_capacity(void* array);
 void array_free(void* array);
 
-#endif /* ARRAY_H */
\ No newline at end of file
+/**
+ * Optional allocator hook used by every array (NULL restores realloc/free)
+ */
+typedef void* (*array_realloc_fn)(void* pointer, size_t size);
+typedef void (*array_free_fn)(void* pointer);
+
+void array_set_allocator(array_realloc_fn realloc_fn, array_free_fn free_fn);
+
+#endif /* ARRAY_H */
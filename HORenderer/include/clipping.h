@@ -0,0 +1,40 @@
+#ifndef CLIPPING_H
+#define CLIPPING_H
+
+#include <stdbool.h>
+
+#include "vector.h"
+#include "texture.h"
+
+/**
+ * A triangle clipped against the frustum planes becomes a convex polygon of at most
+ * 3 + (number of planes) vertices, which is rendered as a triangle fan
+ */
+#define MAX_NUM_POLY_VERTICES       10
+#define MAX_NUM_POLY_TRIANGLES      (MAX_NUM_POLY_VERTICES - 2)
+
+/**
+ * Guard band (in multiples of the viewport half-extent)
+ * Triangles that stay inside it are never clipped against the side planes,
+ * the rasterizer's screen clamp takes care of the part that is off-screen.
+ * Its 28.4 fixed-point edge setup is 64-bit, so the factor is not limited by integer range.
+ */
+#define GUARD_BAND_FACTOR           4.0f
+
+typedef struct {
+    vec4_t vertices[MAX_NUM_POLY_VERTICES];     // clip space (before the perspective divide)
+    tex2_t texcoords[MAX_NUM_POLY_VERTICES];
+    float shades[MAX_NUM_POLY_VERTICES];        // light intensity of the vertices (Gouraud shading)
+    int num_vertices;
+} polygon_t;
+
+typedef enum {
+    CLIP_REJECTED,      // completely outside of the frustum
+    CLIP_ACCEPTED,      // inside the guard band, no clipping needed
+    CLIP_CLIPPED        // intersected with one or more planes
+} clip_result_t;
+
+polygon_t polygon_from_triangle(vec4_t v0, vec4_t v1, vec4_t v2, tex2_t t0, tex2_t t1, tex2_t t2, const float shades[3]);
+clip_result_t clip_polygon(polygon_t* polygon);
+
+#endif /* CLIPPING_H */
@@ -15,7 +15,7 @@
 enum CullMethod {
     CULL_NONE,
     CULL_BACKFACE
-} CullMethod;
+};
 
 enum RenderMethod {
     RENDER_WIRE,
@@ -23,8 +23,31 @@ enum RenderMethod {
     RENDER_FILL_TRIANGLE,
     RENDER_FILL_TRIANGLE_WIRE,
     RENDER_TEXTURED,
-    RENDER_TEXTURED_WIRE
-} RenderMethod;
+    RENDER_TEXTURED_WIRE,
+    RENDER_OVERDRAW         // heatmap of the number of depth test passes per pixel
+};
+
+enum SortMethod {
+    SORT_NONE,              // triangles are rasterized in face order
+    SORT_FRONT_TO_BACK      // nearest triangles first, so hidden pixels fail the depth test before shading
+};
+
+enum ShadeMethod {
+    SHADE_FLAT,             // one light intensity per face, from the face normal
+    SHADE_GOURAUD           // light intensity per vertex, from the vertex normals, interpolated across the face
+};
+
+enum FilterMethod {
+    FILTER_NEAREST,         // nearest texel of the base level
+    FILTER_MIP_NEAREST,     // nearest texel of the mip level that matches the texel footprint of the pixels
+    FILTER_MIP_BILINEAR     // bilinear filtering of that mip level
+};
+
+extern enum CullMethod CullMethod;
+extern enum SortMethod SortMethod;
+extern enum ShadeMethod ShadeMethod;
+extern enum FilterMethod FilterMethod;
+extern enum RenderMethod RenderMethod;
 
 /**
  * SDL variables
@@ -35,20 +58,43 @@ extern SDL_Texture* colorBufferTexture;
 
 extern uint32_t* colorBuffer;
 extern float* zBuffer;
+extern int colorBufferPitch;    // row pitch of the color buffer and the z-buffer, in pixels
+extern bool directPresent;      // true when finished pixels are written straight into the locked texture memory
 extern int windowWidth;
 extern int windowHeight;
 
+/**
+ * Pixel format of the color buffer and of the texture presenting it
+ * Color constants in the code are written as 0xAARRGGBB, which is ARGB8888 in a 32-bit value.
+ */
+#define COLOR_BUFFER_FORMAT SDL_PIXELFORMAT_ARGB8888
+
+/**
+ * Background of the color buffer (clear color plus a dotted grid)
+ */
+#define CLEAR_COLOR         0xFF000000
+#define GRID_COLOR          0xFF333333
+
 /**
  * Methods prototypes for display
  */
 bool initializeWindow();
+bool initializeOffscreen(int width, int height);
 void drawGrid(uint32_t color);
 void drawPixel(Point p, uint32_t color);
 void drawLine(Point p0, Point p1, uint32_t color);
 void drawRect(Point origin, int width, int height, uint32_t color);
+bool initializeColorBuffer();
+bool lockColorBuffer();
+void presentColorBufferRect(int minX, int minY, int maxX, int maxY);
 void renderColorBuffer();
 void clearColorBuffer(uint32_t color);
 void clearZBuffer();
+void clearColorBufferRect(int minX, int minY, int maxX, int maxY, uint32_t color, bool streaming);
+void clearZBufferRect(int minX, int minY, int maxX, int maxY);
+void drawGridRect(int minX, int minY, int maxX, int maxY, uint32_t color);
+void resolveOverdrawRect(int minX, int minY, int maxX, int maxY);
+void destroyColorBuffer();
 void destroyWindow();
 
 #endif  /* DISPLAY_H */
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdbool.h>
+
+/**
+ * Asset loading jobs
+ * Loads are queued with queueAssetLoad() and run concurrently by loadQueuedAssets(), so a scene
+ * loads in about the time of its largest asset rather than the sum of all of them. A load must
+ * only write the state of its own asset (the mesh and the texture loaders use separate globals).
+ */
+#define MAX_ASSET_LOADS     16
+
+typedef bool (*asset_loader_t)(char* file);
+
+bool queueAssetLoad(asset_loader_t load, char* file);
+
+/**
+ * Run the queued loads on up to 'numThreads' threads, the calling thread included, and return once
+ * all of them are done (false if any failed). The queue is empty afterwards.
+ */
+bool loadQueuedAssets(int numThreads);
+
+#endif /* LOADER_H */
@@ -0,0 +1,30 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Read-only memory mapped file (CreateFileMapping on Windows, mmap everywhere else)
+ */
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    void* file_handle;          // Windows only
+    void* mapping_handle;       // Windows only
+} mapped_file_t;
+
+/**
+ * Access hint of a mapping
+ * Sequential lets the system read ahead and drop the pages already read, it is only meant for
+ * files parsed once from start to end; mappings kept as storage use the normal policy.
+ */
+typedef enum {
+    MAP_ACCESS_NORMAL,
+    MAP_ACCESS_SEQUENTIAL
+} map_access_t;
+
+bool map_file(const char* filename, map_access_t access, mapped_file_t* file);
+void unmap_file(mapped_file_t* file);
+
+#endif /* MAPPED_FILE_H */
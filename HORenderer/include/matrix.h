@@ -1,6 +1,8 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <stddef.h>
+
 #include "vector.h"
 
 /**
@@ -18,12 +20,26 @@ mat4_t mat4_make_rotation_x(float angle);
 mat4_t mat4_make_rotation_y(float angle);
 mat4_t mat4_make_rotation_z(float angle);
 mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar);
+mat4_t mat4_make_normal(const mat4_t* m);
 
 /**
  * Multiply methods
+ * Matrices are passed by pointer; 'result' may be 'a' or 'b' (e.g. to accumulate a world matrix in place).
+ */
+vec4_t mat4_multiply_vec4(const mat4_t* m, vec4_t v);
+void mat4_multiply_mat4(const mat4_t* a, const mat4_t* b, mat4_t* result);
+vec4_t mat4_multiply_vec4_project(const mat4_t* projectionMatrix, vec4_t v);
+
+/**
+ * Batch methods (SSE2 when available, same results as the single vector methods)
+ * mat4_transform_vec3_array: out[i] = m * (in[i], 1)
+ * mat4_transform_dir3_array: out[i] = xyz of m * (in[i], 0), for directions such as normals
+ * mat4_project_vec3_array: the same followed by the perspective divide and the mapping to a viewport
+ * of 'width' x 'height' pixels (y down, w keeps the view depth). The points are not clipped, so they
+ * must be in front of the camera; clipped geometry is projected after clipping instead.
  */
-vec4_t mat4_multiply_vec4(mat4_t m, vec4_t v);
-mat4_t mat4_multiply_mat4(mat4_t a, mat4_t b);
-vec4_t mat4_multiply_vec4_project(mat4_t projectionMatrix, vec4_t v);
+void mat4_transform_vec3_array(const mat4_t* m, const vec3_t* in, vec4_t* out, size_t count);
+void mat4_transform_dir3_array(const mat4_t* m, const vec3_t* in, vec3_t* out, size_t count);
+void mat4_project_vec3_array(const mat4_t* m, const vec3_t* in, vec4_t* out, size_t count, float width, float height);
 
 #endif /* MATRIX_H */
\ No newline at end of file
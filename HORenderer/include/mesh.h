@@ -1,8 +1,13 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "vector.h"
+#include "matrix.h"
 #include "triangle.h"
+#include "mapped_file.h"
 
 #define N_CUBE_VERTICES     8
 
@@ -13,16 +18,63 @@ extern vec3_t cube_vertices[N_CUBE_VERTICES];
 extern face_t cube_faces[N_CUBE_FACES];
 
 typedef struct {
-    vec3_t* vertices;       // dynamic array of vertices
-    face_t* faces;          // dynamic array of faces
+    vec3_t* vertices;       // dynamic array of vertices (or a view into 'mapping')
+    face_t* faces;          // dynamic array of faces (or a view into 'mapping')
+    vec3_t* normals;        // dynamic array of unit vertex normals, indexed by the face corners (or a view into 'mapping')
+    vec3_t* face_normals;   // dynamic array of unit face normals, one per face (or a view into 'mapping')
+    int num_vertices;
+    int num_faces;
+    int num_normals;
+    mapped_file_t mapping;  // binary mesh file backing the arrays above, if loaded with load_mesh_file
     vec3_t rotation;        // rotation with x, y and z values
     vec3_t scale;           // scale with x, y and z values
     vec3_t translation;     // translation with x, y, z values
+    vec4_t* world_vertices; // dynamic array of vertices transformed to world space this frame
+    vec4_t* clip_vertices;  // dynamic array of vertices transformed to clip space this frame
+    vec3_t* world_normals;  // dynamic array of vertex normals transformed to world space this frame
+    vec3_t* world_face_normals; // dynamic array of face normals transformed to world space this frame
 } mesh_t;
 
 extern mesh_t mesh;
 
+/**
+ * Binary mesh file (written offline from an OBJ file, see tools/obj2mesh.c)
+ * | header | vertex block (vec3_t[num_vertices]) | face block (face_t[num_faces]) |
+ * | normal block (vec3_t[num_normals]) | face normal block (vec3_t[num_faces]) |
+ * Blocks are 16-byte aligned and stored in the in-memory layout of the renderer (little-endian),
+ * so the loader maps the file and points the mesh at the blocks without parsing or copying.
+ */
+#define MESH_FILE_MAGIC         0x48534D48      // "HMSH"
+#define MESH_FILE_VERSION       2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t face_size;         // sizeof(face_t) of the writer, must match the reader
+    uint32_t num_vertices;
+    uint32_t num_faces;
+    uint32_t num_normals;
+    uint32_t reserved;
+    uint64_t vertex_offset;     // byte offset of the vertex block from the start of the file
+    uint64_t face_offset;       // byte offset of the face block from the start of the file
+    uint64_t normal_offset;     // byte offset of the normal block from the start of the file
+    uint64_t face_normal_offset; // byte offset of the face normal block from the start of the file
+    vec3_t bounds_min;
+    vec3_t bounds_max;
+} mesh_file_header_t;
+
 void load_cube_mesh_data(void);
-void load_obj_file_data(char* filename);
+bool load_obj_file_data(char* filename);
+bool load_mesh_file(char* filename);
+bool save_mesh_file(char* filename);
+void free_mesh(void);
+
+/**
+ * Vertex processing stage
+ * Transform every mesh vertex and normal once per frame; faces index into the transformed buffers.
+ * Normals are transformed with mat4_make_normal(world_matrix).
+ */
+void transform_mesh_vertices(const mat4_t* world_matrix, const mat4_t* projection_matrix);
 
 #endif /* MESH_H */
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+
+#include "arena.h"
+#include "matrix.h"
+#include "triangle.h"
+
+/**
+ * Triangles that should be rendered each frame
+ * The queue lives in a per-frame arena that only holds triangles, so consecutive pushes are
+ * contiguous; it is rewound every frame and only allocates while growing to its peak size.
+ */
+#define RENDER_QUEUE_RESERVE    ((size_t)1 << 30)
+
+extern arena_t renderQueueArena;
+extern triangle_t* trianglesToRender;
+extern int numTrianglesToRender;
+
+/**
+ * Global Transformation Matrices
+ */
+extern mat4_t worldMatrix;
+extern mat4_t projectMatrix;
+
+/**
+ * Frame pipeline shared by the windowed renderer and the headless benchmark
+ * A frame is transformFrame() -> rasterizeFrame() -> presentFrame(), on top of a render
+ * target created with initializeWindow() or initializeOffscreen(), once the mesh and the
+ * texture are loaded. 'numThreads' counts the rasterizer threads, the calling thread included.
+ */
+bool initializePipeline(int numThreads);
+bool loadMesh(char* meshFile);      // binary mesh (.mesh) or OBJ file
+void transformFrame(void);
+void rasterizeFrame(void);
+void presentFrame(void);
+void destroyPipeline(void);
+
+#endif /* PIPELINE_H */
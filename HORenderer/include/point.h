@@ -7,18 +7,22 @@ typedef struct
     int y;
 } Point;
 
+/**
+ * Screen space vertices of the triangle rasterizer
+ * x and y keep their fractional part: the rasterizer snaps them to sub-pixel precision.
+ */
 typedef struct
 {
-    int x;
-    int y;
+    float x;
+    float y;
     float z;
     float w;
 } Point4;
 
 typedef struct
 {
-    int x;
-    int y;
+    float x;
+    float y;
     float z;
     float w;
     float u;
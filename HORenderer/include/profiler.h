@@ -0,0 +1,100 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Frame stages timed by the profiler (main thread)
+ */
+typedef enum {
+    PROFILE_INPUT,          // event processing
+    PROFILE_VERTICES,       // batch vertex transform
+    PROFILE_FACES,          // per-face culling, clipping, lighting and queueing
+    PROFILE_SORT,           // front-to-back ordering of the queued triangles
+    PROFILE_RASTER,         // binning, tile clears and tile rasterization
+    PROFILE_OVERLAY,        // wireframe and vertex overlays
+    PROFILE_PRESENT,        // color buffer upload/unlock and SDL present
+    NUM_PROFILE_STAGES
+} profile_stage_t;
+
+/**
+ * Per-frame counters
+ */
+typedef enum {
+    COUNTER_FACES_SUBMITTED,    // mesh faces processed
+    COUNTER_FACES_CULLED,       // faces removed by backface culling
+    COUNTER_FACES_REJECTED,     // faces completely outside of the frustum
+    COUNTER_FACES_CLIPPED,      // faces intersected with one or more frustum planes
+    COUNTER_TRIANGLES,          // triangles queued for rasterization
+    COUNTER_TRIANGLES_DROPPED,  // triangles that did not fit in the render queue arena
+    COUNTER_QUEUE_BYTES,        // bytes of the render queue arena used by the frame
+    COUNTER_TILES_RASTERIZED,   // tiles with at least one triangle
+    COUNTER_TILES_CLEARED,      // dirty tiles without triangles (background refill only)
+    COUNTER_PIXELS_TESTED,      // covered pixels that went through the depth test
+    COUNTER_DEPTH_FAILED,       // covered pixels that failed the depth test
+    COUNTER_TEXELS_FETCHED,     // texture fetches
+    NUM_PROFILE_COUNTERS
+} profile_counter_t;
+
+/**
+ * Ring buffer of the last PROFILE_HISTORY frames
+ * Times are performance counter ticks relative to initializeProfiler().
+ */
+#define PROFILE_HISTORY     256
+
+typedef struct {
+    uint64_t start;
+    uint64_t duration;
+    uint64_t stageStart[NUM_PROFILE_STAGES];
+    uint64_t stageDuration[NUM_PROFILE_STAGES];
+    int counters[NUM_PROFILE_COUNTERS];
+} profile_frame_t;
+
+/**
+ * On-screen overlay drawn into the color buffer: a stacked graph of the stage times of the
+ * recorded frames (one column per frame) and the mean time of every stage and of the frame
+ */
+#define PROFILE_HUD_GRAPH_HEIGHT    100
+#define PROFILE_HUD_GRAPH_MS        (2.0 * FRAME_TARGET_TIME)     // frame time at the top of the graph
+#define PROFILE_HUD_WIDTH           PROFILE_HISTORY
+#define PROFILE_HUD_HEIGHT          (PROFILE_HUD_GRAPH_HEIGHT + 32)
+#define PROFILE_HUD_X               10
+#define PROFILE_HUD_Y               10
+
+extern bool profilerEnabled;
+extern bool profilerHudVisible;
+
+void initializeProfiler(bool enabled);
+void beginProfileFrame(void);
+void endProfileFrame(void);
+void beginProfileStage(profile_stage_t stage);
+void endProfileStage(profile_stage_t stage);
+void setProfileCounter(profile_counter_t counter, int value);
+const profile_frame_t* lastProfileFrame(void);
+const char* profileCounterName(profile_counter_t counter);
+void drawProfilerHud(int x, int y);
+bool writeProfilerTrace(const char* filename);
+
+/**
+ * Instrumentation macros
+ * When the profiler is disabled at runtime they cost one predictable branch, and building
+ * with HORENDERER_NO_PROFILER removes them completely.
+ * PROFILE_SCOPE times the statement or block that follows it (do not break or return out of it):
+ *     PROFILE_SCOPE(PROFILE_RASTER) { rasterizeTriangles(...); }
+ */
+#ifndef HORENDERER_NO_PROFILER
+#define PROFILE_BEGIN(stage)            do { if (profilerEnabled) { beginProfileStage(stage); } } while (0)
+#define PROFILE_END(stage)              do { if (profilerEnabled) { endProfileStage(stage); } } while (0)
+#define PROFILE_COUNTER(counter, value) do { if (profilerEnabled) { setProfileCounter(counter, value); } } while (0)
+#define PROFILE_SCOPE(stage) \
+    for (int profileScopeOnce = (profilerEnabled ? (beginProfileStage(stage), 1) : 1); profileScopeOnce; \
+         profileScopeOnce = (profilerEnabled ? (endProfileStage(stage), 0) : 0))
+#else
+#define PROFILE_BEGIN(stage)            ((void)0)
+#define PROFILE_END(stage)              ((void)0)
+#define PROFILE_COUNTER(counter, value) ((void)0)
+#define PROFILE_SCOPE(stage)
+#endif
+
+#endif /* PROFILER_H */
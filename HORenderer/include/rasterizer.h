@@ -0,0 +1,32 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "triangle.h"
+
+/**
+ * Screen tiles used for binning (TILE_SIZE x TILE_SIZE pixels)
+ */
+#define TILE_SIZE           64
+
+/**
+ * Tile-binned rasterizer
+ * Projected triangles are sorted into the screen tiles they overlap, then a pool of worker
+ * threads rasterizes whole tiles. Each tile is claimed by exactly one thread per frame, so
+ * that thread owns the tile's color and depth memory and no locking is needed.
+ * Triangles keep their submission order inside every tile, so the image does not depend
+ * on the number of threads. 'order' (NULL for the array order) is the submission order.
+ * The rasterizer also owns the frame clears: every tile gets its background (and depth, when
+ * used) back during rasterizeTriangles(), so it must be called every frame, in every RenderMethod.
+ * With 'presentTiles', every tile that changed this frame is also copied into the locked color buffer
+ * texture by the thread that drew it (see presentColorBufferRect()); the texture keeps the other tiles.
+ */
+bool initializeRasterizer(int numThreads);
+void rasterizeTriangles(triangle_t* triangles, int numTriangles, const int* order, const texture_t* texture, bool presentTiles);
+void invalidateTiles(void);
+void invalidateTileRect(int minX, int minY, int maxX, int maxY);
+void destroyRasterizer(void);
+
+#endif /* RASTERIZER_H */
@@ -0,0 +1,13 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/**
+ * SSE2 is always available on x64 (and on x86 when compiled with /arch:SSE2 or -msse2).
+ * Define HORENDERER_NO_SIMD to force the scalar code paths.
+ */
+#if !defined(HORENDERER_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+#endif /* SIMD_H */
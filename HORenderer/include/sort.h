@@ -0,0 +1,12 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stdint.h>
+
+/**
+ * Stable LSD radix sort of the indices 0..count-1 by 16-bit keys (two 8-bit passes)
+ * On return 'order' holds the indices in ascending key order; 'scratch' needs 'count' ints.
+ */
+void radix_sort_u16(const uint16_t* keys, int* order, int* scratch, int count);
+
+#endif /* SORT_H */
@@ -2,19 +2,62 @@
 #define TEXTURE_H
 
 #include <stdint.h>
-#include "upng.h"
+#include <stdlib.h>
+#include <stdbool.h>
 
 typedef struct {
     float u;
     float v;
 } tex2_t;
 
-extern int texture_width;
-extern int texture_height;
+/**
+ * Texel layout of a texture level
+ * Power-of-two levels are stored in Morton (Z) order: the bits of x and y are interleaved, so texels
+ * that are close in 2D are close in memory whatever the direction of the triangle is walked in, and
+ * every 4x4 block of texels is one 64-byte cache line. Coordinates wrap with a mask.
+ * Other sizes stay in row-major order and wrap with a modulo.
+ * The offset of texel (x, y) is offsets_x[x] + offsets_y[y] in both layouts.
+ */
+typedef struct {
+    uint32_t* texels;       // COLOR_BUFFER_FORMAT texels
+    int width;
+    int height;
+    int width_mask;         // width - 1 for power-of-two widths, -1 otherwise
+    int height_mask;        // height - 1 for power-of-two heights, -1 otherwise
+    uint32_t* offsets_x;
+    uint32_t* offsets_y;
+} texture_level_t;
+
+/**
+ * Mip chain: every level is the previous one downsampled by 2 (box filter) down to 1x1
+ * Only power-of-two textures get a chain, other sizes only have their base level.
+ */
+#define MAX_TEXTURE_LEVELS  16
+
+typedef struct {
+    texture_level_t levels[MAX_TEXTURE_LEVELS];     // levels[0] is the base level
+    int num_levels;
+} texture_t;
+
+extern texture_t mesh_texture;
+
+bool load_png_texture_data(char* filename);
+void free_png_texture(void);
+
+/**
+ * Fetch the texel at integer texel coordinates (any value, wrapped around the level)
+ */
+static inline uint32_t texture_sample(const texture_level_t* level, int x, int y)
+{
+    x = (level->width_mask >= 0) ? (x & level->width_mask) : (abs(x) % level->width);
+    y = (level->height_mask >= 0) ? (y & level->height_mask) : (abs(y) % level->height);
 
-extern upng_t* png_texture;
-extern uint32_t* mesh_texture;
+    return level->texels[level->offsets_x[x] + level->offsets_y[y]];
+}
 
-void load_png_texture_data(char* filename);
+/**
+ * Bilinear filtering of the four texels around (x, y), in texel units of the level (texel centers at +0.5)
+ */
+uint32_t texture_sample_bilinear(const texture_level_t* level, float x, float y);
 
-#endif /* TEXTURE_H */
\ No newline at end of file
+#endif /* TEXTURE_H */
@@ -2,6 +2,7 @@
 #define TRIANGLE_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "point.h"
 #include "vector.h"
@@ -11,20 +12,55 @@ typedef struct {
     int a;
     int b;
     int c;
-    tex2_t a_uv;0
+    tex2_t a_uv;
     tex2_t b_uv;
     tex2_t c_uv;
+    int a_normal;           // vertex normal indices of the corners (into mesh.normals)
+    int b_normal;
+    int c_normal;
     uint32_t color;
 } face_t;
 
 typedef struct {
     vec4_t points[3];
     tex2_t texcoords[3];
-    uint32_t color;
+    float shades[3];        // light intensity of the vertices (Gouraud shading only)
+    uint32_t color;         // lit face color (flat shading) or unlit face color (Gouraud shading)
 } triangle_t;
 
+/**
+ * Inclusive pixel bounds a triangle is rasterized into (the whole screen or a single screen tile)
+ */
+typedef struct {
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+} ClipRect;
+
+/**
+ * Pixel statistics of the clipped draw functions (one instance per rasterizer thread)
+ */
+typedef struct {
+    int pixelsTested;       // covered pixels that went through the depth test
+    int depthFailed;        // covered pixels that failed the depth test
+    int texelsFetched;      // texels read for the textured pixels that passed the depth test (4 per pixel when bilinear)
+} raster_stats_t;
+
+ClipRect screenClipRect(void);
+
 void drawTriangle(Point p0, Point p1, Point p2, uint32_t color);
 void drawFilledTriangle(Point4 p0, Point4 p1, Point4 p2, uint32_t color);
-void drawTexturedTriangle(TexturePoint p, TexturePoint p1, TexturePoint p2, uint32_t* texture);
+void drawTexturedTriangle(TexturePoint p, TexturePoint p1, TexturePoint p2, const texture_t* texture);
+
+/**
+ * Draw functions limited to a clip rect, 'stats' is NULL when not counting
+ * drawShadedTriangleClipped() scales 'color' by the light intensity interpolated from the vertex 'shades'.
+ * drawOverdrawTriangleClipped() increments the color buffer value of the pixels that pass the depth test.
+ */
+void drawFilledTriangleClipped(Point4 p0, Point4 p1, Point4 p2, uint32_t color, ClipRect clip, raster_stats_t* stats);
+void drawShadedTriangleClipped(Point4 p0, Point4 p1, Point4 p2, uint32_t color, const float shades[3], ClipRect clip, raster_stats_t* stats);
+void drawOverdrawTriangleClipped(Point4 p0, Point4 p1, Point4 p2, ClipRect clip, raster_stats_t* stats);
+void drawTexturedTriangleClipped(TexturePoint p0, TexturePoint p1, TexturePoint p2, const texture_t* texture, ClipRect clip, raster_stats_t* stats);
 
 #endif /* TRIANGLE_H */
\ No newline at end of file
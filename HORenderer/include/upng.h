@@ -55,6 +55,12 @@ typedef enum upng_format {
 	UPNG_LUMINANCE_ALPHA8
 } upng_format;
 
+/* pixel formats of upng_decode_into, 8 bits per channel whatever the format of the image */
+typedef enum upng_output_format {
+	UPNG_OUTPUT_RGBA8,		/* R, G, B, A bytes */
+	UPNG_OUTPUT_ARGB8888	/* 32-bit native endian words, 0xAARRGGBB */
+} upng_output_format;
+
 typedef struct upng_t upng_t;
 
 upng_t*		upng_new_from_bytes	(const unsigned char* buffer, unsigned long size);
@@ -63,6 +69,7 @@ void		upng_free			(upng_t* upng);
 
 upng_error	upng_header			(upng_t* upng);
 upng_error	upng_decode			(upng_t* upng);
+upng_error	upng_decode_into	(upng_t* upng, void* pixels, unsigned long stride, upng_output_format format);
 
 upng_error	upng_get_error		(const upng_t* upng);
 unsigned	upng_get_error_line	(const upng_t* upng);
@@ -0,0 +1,87 @@
+#include "arena.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/* Memory is committed in steps of this size */
+#define ARENA_COMMIT_GRANULARITY    (64 * 1024)
+
+static size_t align_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool arena_init(arena_t* arena, size_t reserve_size)
+{
+    arena->reserved = align_up(reserve_size, ARENA_COMMIT_GRANULARITY);
+    arena->committed = 0;
+    arena->used = 0;
+    arena->peak = 0;
+
+#ifdef _WIN32
+    arena->base = (unsigned char*)VirtualAlloc(NULL, arena->reserved, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    /* Anonymous pages are only backed by memory once they are touched */
+    void* base = mmap(NULL, arena->reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    arena->base = (base == MAP_FAILED) ? NULL : (unsigned char*)base;
+#endif
+
+    if (arena->base == NULL) {
+        arena->reserved = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void* arena_push(arena_t* arena, size_t size, size_t alignment)
+{
+    size_t offset = align_up(arena->used, alignment);
+    size_t end = offset + size;
+
+    if (end > arena->reserved) { return NULL; }
+
+    if (end > arena->committed) {
+        size_t commit = align_up(end, ARENA_COMMIT_GRANULARITY);
+
+#ifdef _WIN32
+        if (!VirtualAlloc(arena->base + arena->committed, commit - arena->committed, MEM_COMMIT, PAGE_READWRITE)) {
+            return NULL;
+        }
+#endif
+
+        arena->committed = commit;
+    }
+
+    arena->used = end;
+
+    if (end > arena->peak) { arena->peak = end; }
+
+    return arena->base + offset;
+}
+
+void arena_reset(arena_t* arena)
+{
+    arena->used = 0;
+}
+
+void arena_release(arena_t* arena)
+{
+    if (arena->base) {
+#ifdef _WIN32
+        VirtualFree(arena->base, 0, MEM_RELEASE);
+#else
+        munmap(arena->base, arena->reserved);
+#endif
+    }
+
+    arena->base = NULL;
+    arena->reserved = 0;
+    arena->committed = 0;
+    arena->used = 0;
+}
@@ -3,44 +3,98 @@
 
 #include "array.h"
 
-#define ARRAY_RAW_DATA(array)       ((int*)(array) - 2)
+#define ARRAY_HEADER_SIZE           (sizeof(size_t) * 2)
+#define ARRAY_RAW_DATA(array)       ((size_t*)(array) - 2)
 #define ARRAY_CAPACITY(array)       (ARRAY_RAW_DATA(array)[0])
 #define ARRAY_OCCUPIED(array)       (ARRAY_RAW_DATA(array)[1])
 
-void* array_hold(void* array, int count, int item_size)
+#define ARRAY_MIN_CAPACITY          16
+
+static array_realloc_fn array_realloc = realloc;
+static array_free_fn array_release = free;
+
+void array_set_allocator(array_realloc_fn realloc_fn, array_free_fn free_fn)
+{
+    array_realloc = realloc_fn ? realloc_fn : realloc;
+    array_release = free_fn ? free_fn : free;
+}
+
+/**
+ * Reallocate the array to exactly 'capacity' elements, keeping the occupied length
+ */
+static void* array_resize(void* array, size_t capacity, size_t item_size)
+{
+    size_t occupied = (array != NULL) ? ARRAY_OCCUPIED(array) : 0;
+    size_t* base = (size_t*)array_realloc((array != NULL) ? ARRAY_RAW_DATA(array) : NULL, ARRAY_HEADER_SIZE + (item_size * capacity));
+
+    if (base == NULL) {
+        fprintf(stderr, "Array allocation of %zu elements failed.\n", capacity);
+        abort();
+    }
+
+    base[0] = capacity;
+    base[1] = occupied;
+
+    return base + 2;
+}
+
+void* array_hold(void* array, size_t count, size_t item_size)
+{
+    size_t needed = array_length(array) + count;
+
+    if (array == NULL || needed > ARRAY_CAPACITY(array)) {
+        /* Grow geometrically so repeated pushes are amortized O(1) */
+        size_t capacity = (array != NULL) ? ARRAY_CAPACITY(array) * 2 : ARRAY_MIN_CAPACITY;
+
+        if (capacity < needed) { capacity = needed; }
+
+        array = array_resize(array, capacity, item_size);
+    }
+
+    ARRAY_OCCUPIED(array) = needed;
+
+    return array;
+}
+
+void* array_reserve(void* array, size_t capacity, size_t item_size)
 {
-    if (array == NULL) {
-        int raw_size = (sizeof(int) * 2) + (item_size * count);
-        int* base = (int*)malloc(raw_size);
+    if (array == NULL || capacity > ARRAY_CAPACITY(array)) {
+        array = array_resize(array, capacity, item_size);
+    }
 
-        base[0] = count;    // capacity
-        base[1] = count;    // occupied
+    return array;
+}
 
-        return base + 2;
-    } else if (ARRAY_OCCUPIED(array) + count <= ARRAY_CAPACITY(array)) {
-        ARRAY_OCCUPIED(array) += count;
+void* array_shrink_to_fit(void* array, size_t item_size)
+{
+    if (array == NULL || ARRAY_OCCUPIED(array) == ARRAY_CAPACITY(array)) {
         return array;
-    } else {
-        int needed_size = ARRAY_OCCUPIED(array) + count;
-        int float_curr = ARRAY_CAPACITY(array) * 2;
-        int capacity = needed_size;
-        int occupied = needed_size;
-        int raw_size = sizeof(int) * 2 + item_size * capacity;
-        int* base = (int*)realloc(ARRAY_RAW_DATA(array), raw_size);
-
-        base[0] = capacity;
-        base[1] = occupied;
-
-        return base + 2;
+    }
+
+    return array_resize(array, ARRAY_OCCUPIED(array), item_size);
+}
+
+void array_clear(void* array)
+{
+    /* Only the length is reset, the capacity is kept for reuse */
+    if (array != NULL) {
+        ARRAY_OCCUPIED(array) = 0;
     }
 }
 
-int array_length(void* array) {
+size_t array_length(void* array)
+{
     return (array != NULL) ? ARRAY_OCCUPIED(array) : 0;
 }
 
-void array_free(void* array) {
+size_t array_capacity(void* array)
+{
+    return (array != NULL) ? ARRAY_CAPACITY(array) : 0;
+}
+
+void array_free(void* array)
+{
     if (array != NULL) {
-        free(ARRAY_RAW_DATA(array));
+        array_release(ARRAY_RAW_DATA(array));
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,157 @@
+#include "clipping.h"
+
+/**
+ * Clip space planes (the projection matrix maps the view volume to -w <= x, y <= w and 0 <= z <= w)
+ */
+enum {
+    LEFT_PLANE,
+    RIGHT_PLANE,
+    BOTTOM_PLANE,
+    TOP_PLANE,
+    NEAR_PLANE,
+    FAR_PLANE,
+    NUM_PLANES
+};
+
+/**
+ * Signed distance of a clip space vertex to a plane (inside when >= 0)
+ * 'extent' widens the side planes: 1.0 is the view frustum, GUARD_BAND_FACTOR the guard band
+ */
+static float plane_distance(int plane, vec4_t v, float extent)
+{
+    switch (plane) {
+        case LEFT_PLANE:    return v.x + (extent * v.w);
+        case RIGHT_PLANE:   return (extent * v.w) - v.x;
+        case BOTTOM_PLANE:  return v.y + (extent * v.w);
+        case TOP_PLANE:     return (extent * v.w) - v.y;
+        case NEAR_PLANE:    return v.z;
+        default:            return v.w - v.z;
+    }
+}
+
+static int compute_outcode(vec4_t v, float extent)
+{
+    int outcode = 0;
+
+    for (int plane = 0; plane < NUM_PLANES; plane++) {
+        if (plane_distance(plane, v, extent) < 0) { outcode |= (1 << plane); }
+    }
+
+    return outcode;
+}
+
+static float float_lerp(float a, float b, float t)
+{
+    return a + ((b - a) * t);
+}
+
+polygon_t polygon_from_triangle(vec4_t v0, vec4_t v1, vec4_t v2, tex2_t t0, tex2_t t1, tex2_t t2, const float shades[3])
+{
+    polygon_t polygon = {
+        .vertices = { v0, v1, v2 },
+        .texcoords = { t0, t1, t2 },
+        .shades = { shades[0], shades[1], shades[2] },
+        .num_vertices = 3
+    };
+
+    return polygon;
+}
+
+/**
+ * Sutherland-Hodgman clipping of the polygon against a single plane
+ * Clip space attributes are linear, so positions, texcoords and shades are interpolated with the same factor
+ */
+static void clip_polygon_against_plane(polygon_t* polygon, int plane, float extent)
+{
+    vec4_t inside_vertices[MAX_NUM_POLY_VERTICES];
+    tex2_t inside_texcoords[MAX_NUM_POLY_VERTICES];
+    float inside_shades[MAX_NUM_POLY_VERTICES];
+    int num_inside_vertices = 0;
+
+    int previous = polygon->num_vertices - 1;
+    float previous_distance = plane_distance(plane, polygon->vertices[previous], extent);
+
+    for (int current = 0; current < polygon->num_vertices; current++) {
+        float current_distance = plane_distance(plane, polygon->vertices[current], extent);
+
+        /* The edge crosses the plane: emit the intersection point */
+        if ((current_distance >= 0) != (previous_distance >= 0)) {
+            float t = previous_distance / (previous_distance - current_distance);
+            vec4_t a = polygon->vertices[previous];
+            vec4_t b = polygon->vertices[current];
+            tex2_t ta = polygon->texcoords[previous];
+            tex2_t tb = polygon->texcoords[current];
+
+            vec4_t intersection = {
+                .x = float_lerp(a.x, b.x, t),
+                .y = float_lerp(a.y, b.y, t),
+                .z = float_lerp(a.z, b.z, t),
+                .w = float_lerp(a.w, b.w, t)
+            };
+            tex2_t intersection_texcoord = {
+                .u = float_lerp(ta.u, tb.u, t),
+                .v = float_lerp(ta.v, tb.v, t)
+            };
+
+            inside_vertices[num_inside_vertices] = intersection;
+            inside_texcoords[num_inside_vertices] = intersection_texcoord;
+            inside_shades[num_inside_vertices] = float_lerp(polygon->shades[previous], polygon->shades[current], t);
+            num_inside_vertices++;
+        }
+
+        /* Keep the current vertex when it is inside */
+        if (current_distance >= 0) {
+            inside_vertices[num_inside_vertices] = polygon->vertices[current];
+            inside_texcoords[num_inside_vertices] = polygon->texcoords[current];
+            inside_shades[num_inside_vertices] = polygon->shades[current];
+            num_inside_vertices++;
+        }
+
+        previous = current;
+        previous_distance = current_distance;
+    }
+
+    for (int i = 0; i < num_inside_vertices; i++) {
+        polygon->vertices[i] = inside_vertices[i];
+        polygon->texcoords[i] = inside_texcoords[i];
+        polygon->shades[i] = inside_shades[i];
+    }
+
+    polygon->num_vertices = num_inside_vertices;
+}
+
+clip_result_t clip_polygon(polygon_t* polygon)
+{
+    int frustum_outcode_and = ~0;
+    int guard_band_outcode_or = 0;
+
+    for (int i = 0; i < polygon->num_vertices; i++) {
+        frustum_outcode_and &= compute_outcode(polygon->vertices[i], 1.0f);
+        guard_band_outcode_or |= compute_outcode(polygon->vertices[i], GUARD_BAND_FACTOR);
+    }
+
+    /* Trivial reject: every vertex is outside of the same frustum plane */
+    if (frustum_outcode_and != 0) {
+        polygon->num_vertices = 0;
+        return CLIP_REJECTED;
+    }
+
+    /* Trivial accept: every vertex is inside the near/far planes and the guard band */
+    if (guard_band_outcode_or == 0) {
+        return CLIP_ACCEPTED;
+    }
+
+    /* Only clip against the planes that at least one vertex is outside of */
+    for (int plane = 0; plane < NUM_PLANES; plane++) {
+        if (guard_band_outcode_or & (1 << plane)) {
+            clip_polygon_against_plane(polygon, plane, GUARD_BAND_FACTOR);
+
+            if (polygon->num_vertices < 3) {
+                polygon->num_vertices = 0;
+                return CLIP_REJECTED;
+            }
+        }
+    }
+
+    return CLIP_CLIPPED;
+}
@@ -1,16 +1,38 @@
+#include <string.h>
+
 #include "display.h"
+#include "simd.h"
 
 /**
  * Extern values
  */
+enum CullMethod CullMethod = CULL_BACKFACE;
+enum SortMethod SortMethod = SORT_NONE;
+enum ShadeMethod ShadeMethod = SHADE_FLAT;
+enum FilterMethod FilterMethod = FILTER_NEAREST;
+enum RenderMethod RenderMethod = RENDER_WIRE;
 SDL_Window* window = NULL;
 SDL_Renderer* renderer = NULL;
 SDL_Texture* colorBufferTexture = NULL;
 uint32_t* colorBuffer = NULL;
 float* zBuffer = NULL;
+int colorBufferPitch = 800;
+bool directPresent = false;
 int windowWidth = 800;
 int windowHeight = 600;
 
+/**
+ * Locked texture memory of the frame in direct presentation (NULL when not locked)
+ * It is only written: reading it back is slow, so the color buffer stays in system memory, where every
+ * read-modify-write happens, and the tiles that changed are written into the texture by presentColorBufferRect().
+ */
+static uint32_t* lockedPixels = NULL;
+
+/**
+ * In-memory surface the SDL software renderer presents to when running without a window
+ */
+static SDL_Surface* offscreenSurface = NULL;
+
 bool initializeWindow() {
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
         fprintf(stderr, "Error initializing SDL.\n");
@@ -46,17 +68,78 @@ bool initializeWindow() {
     return true;
 }
 
+bool initializeOffscreen(int width, int height) {
+    /* No video subsystem: the software renderer draws into a surface, so no display or GPU is needed */
+    if (SDL_Init(SDL_INIT_TIMER) != 0) {
+        fprintf(stderr, "Error initializing SDL.\n");
+        return false;
+    }
+
+    windowWidth = width;
+    windowHeight = height;
+
+    offscreenSurface = SDL_CreateRGBSurfaceWithFormat(0, windowWidth, windowHeight, 32, COLOR_BUFFER_FORMAT);
+
+    if (!offscreenSurface) {
+        fprintf(stderr, "Error creating offscreen surface.\n");
+        return false;
+    }
+
+    renderer = SDL_CreateSoftwareRenderer(offscreenSurface);
+
+    if (!renderer) {
+        fprintf(stderr, "Error creating SDL software renderer.\n");
+        return false;
+    }
+
+    return true;
+}
+
 void drawGrid(uint32_t color) {
-    for (int y = 0; y < windowHeight; y += 10) {
-        for (int x = 0; x < windowWidth; x += 10) {
-            colorBuffer[(windowWidth * y) + x] = color;
+    drawGridRect(0, 0, windowWidth - 1, windowHeight - 1, color);
+}
+
+void drawGridRect(int minX, int minY, int maxX, int maxY, uint32_t color) {
+    /* Grid dots sit on every 10th row and column of the screen */
+    int startX = ((minX + 9) / 10) * 10;
+    int startY = ((minY + 9) / 10) * 10;
+
+    for (int y = startY; y <= maxY; y += 10) {
+        for (int x = startX; x <= maxX; x += 10) {
+            colorBuffer[(colorBufferPitch * y) + x] = color;
+        }
+    }
+}
+
+/**
+ * Overdraw heatmap colors, by number of writes (the last one for every count above)
+ */
+static const uint32_t overdrawColors[] = {
+    0xFF000060, 0xFF0000FF, 0xFF00A0FF, 0xFF00FF00, 0xFFFFFF00, 0xFFFF8000, 0xFFFF0000, 0xFFFFFFFF
+};
+
+#define NUM_OVERDRAW_COLORS     ((uint32_t)(sizeof(overdrawColors) / sizeof(overdrawColors[0])))
+
+void resolveOverdrawRect(int minX, int minY, int maxX, int maxY) {
+    /* The rect holds write counts: pixels without writes get the background back, the others a heat color */
+    for (int y = minY; y <= maxY; y++) {
+        uint32_t* row = &colorBuffer[colorBufferPitch * y];
+
+        for (int x = minX; x <= maxX; x++) {
+            uint32_t count = row[x];
+
+            if (count == 0) {
+                row[x] = (x % 10 == 0 && y % 10 == 0) ? GRID_COLOR : CLEAR_COLOR;
+            } else {
+                row[x] = overdrawColors[(count < NUM_OVERDRAW_COLORS ? count : NUM_OVERDRAW_COLORS) - 1];
+            }
         }
     }
 }
 
 void drawPixel(Point p, uint32_t color) {
     if (p.x >= 0 && p.x < windowWidth && p.y >= 0 && p.y < windowHeight) {
-        colorBuffer[(windowWidth * p.y) + p.x] = color;
+        colorBuffer[(colorBufferPitch * p.y) + p.x] = color;
     }
 }
 
@@ -87,32 +170,236 @@ void drawRect(Point origin, int width, int height, uint32_t color) {
     }
 }
 
-void renderColorBuffer() {
-    SDL_UpdateTexture(
-        colorBufferTexture, NULL, colorBuffer, (int)(windowWidth * sizeof(uint32_t))
+/**
+ * Direct presentation only writes the tiles that changed, so the locked texture memory must keep the last frame.
+ * SDL documents locked pixels as write-only, but the software and OpenGL renderers of SDL 2 lock one persistent
+ * buffer (the surface, or the staging copy uploaded on unlock); others like Direct3D 11 or Metal lock fresh,
+ * undefined memory, where the whole frame would have to be copied anyway and SDL_UpdateTexture() does that.
+ * The renderer must also store COLOR_BUFFER_FORMAT as is, otherwise SDL converts the pixels on unlock.
+ */
+static bool canPresentDirect(Uint32 format) {
+    static const char* keepingRenderers[] = { "software", "opengl", "opengles2" };
+    SDL_RendererInfo info;
+
+    if (SDL_GetRendererInfo(renderer, &info) != 0 || !info.name) { return false; }
+
+    bool keepsPixels = false;
+
+    for (size_t i = 0; i < sizeof(keepingRenderers) / sizeof(keepingRenderers[0]); i++) {
+        if (strcmp(info.name, keepingRenderers[i]) == 0) { keepsPixels = true; }
+    }
+
+    for (Uint32 i = 0; keepsPixels && i < info.num_texture_formats; i++) {
+        if (info.texture_formats[i] == format) { return true; }
+    }
+
+    return false;
+}
+
+bool initializeColorBuffer() {
+    colorBufferTexture = SDL_CreateTexture(
+        renderer, COLOR_BUFFER_FORMAT, SDL_TEXTUREACCESS_STREAMING,
+        windowWidth, windowHeight
     );
 
-    SDL_RenderCopy(renderer, colorBufferTexture, NULL, NULL);
+    if (!colorBufferTexture) {
+        fprintf(stderr, "Error Creating SDL Texture.\n");
+        return false;
+    }
+
+    /* Write finished pixels straight into the texture memory when possible, its pitch becomes the pitch of both buffers */
+    colorBufferPitch = windowWidth;
+    directPresent = false;
+
+    if (canPresentDirect(COLOR_BUFFER_FORMAT)) {
+        void* pixels;
+        int pitch;
+
+        if (SDL_LockTexture(colorBufferTexture, NULL, &pixels, &pitch) == 0) {
+            SDL_UnlockTexture(colorBufferTexture);
+
+            if (pitch % sizeof(uint32_t) == 0) {
+                colorBufferPitch = pitch / (int)sizeof(uint32_t);
+                directPresent = true;
+            }
+        }
+    }
+
+    /* The renderer draws into system memory in both modes, so presentation can fall back to a copy at any time */
+    colorBuffer = (uint32_t*)malloc(sizeof(uint32_t) * colorBufferPitch * windowHeight);
+    zBuffer = (float*)malloc(sizeof(float) * colorBufferPitch * windowHeight);
+
+    if (!colorBuffer || !zBuffer) {
+        fprintf(stderr, "Allocating Color Buffer Failed.\n");
+        return false;
+    }
+
+    return true;
 }
 
-void clearColorBuffer(uint32_t color) {
-    for (int y = 0; y < windowHeight; y++) {
-        for (int x = 0; x < windowWidth; x++) {
-            colorBuffer[(windowWidth * y) + x] = color;
+bool lockColorBuffer() {
+    if (!directPresent) { return false; }
+
+    void* pixels;
+    int pitch;
+
+    if (SDL_LockTexture(colorBufferTexture, NULL, &pixels, &pitch) != 0) {
+        fprintf(stderr, "Error Locking SDL Texture, Presenting From System Memory.\n");
+        directPresent = false;
+        return false;
+    }
+
+    /* The buffers are indexed with the pitch found at initialization, it can not change afterwards */
+    if (pitch != colorBufferPitch * (int)sizeof(uint32_t)) {
+        SDL_UnlockTexture(colorBufferTexture);
+        fprintf(stderr, "SDL Texture Pitch Changed, Presenting From System Memory.\n");
+        directPresent = false;
+        return false;
+    }
+
+    lockedPixels = (uint32_t*)pixels;
+
+    return true;
+}
+
+/**
+ * Copy a finished rect of the color buffer (clipped to the window) into the locked texture memory
+ * The texture is only written, with streaming stores that do not pull it into the cache.
+ * Rects copied by different threads must not overlap.
+ */
+void presentColorBufferRect(int minX, int minY, int maxX, int maxY) {
+    if (!lockedPixels) { return; }
+
+    if (minX < 0) { minX = 0; }
+    if (minY < 0) { minY = 0; }
+    if (maxX > windowWidth - 1) { maxX = windowWidth - 1; }
+    if (maxY > windowHeight - 1) { maxY = windowHeight - 1; }
+
+    int count = maxX - minX + 1;
+
+    for (int y = minY; y <= maxY; y++) {
+        const uint32_t* source = &colorBuffer[(colorBufferPitch * y) + minX];
+        uint32_t* target = &lockedPixels[(colorBufferPitch * y) + minX];
+        int i = 0;
+
+#ifdef HAS_SSE2
+        for (; i < count && ((uintptr_t)&target[i] & 15) != 0; i++) {
+            target[i] = source[i];
+        }
+
+        for (; i + 4 <= count; i += 4) {
+            _mm_stream_si128((__m128i*)&target[i], _mm_loadu_si128((const __m128i*)&source[i]));
+        }
+#endif
+
+        for (; i < count; i++) {
+            target[i] = source[i];
         }
     }
+
+#ifdef HAS_SSE2
+    /* Make the streaming stores visible before the main thread unlocks the texture */
+    _mm_sfence();
+#endif
+}
+
+void renderColorBuffer() {
+    if (lockedPixels) {
+        SDL_UnlockTexture(colorBufferTexture);
+        lockedPixels = NULL;
+    } else {
+        SDL_UpdateTexture(
+            colorBufferTexture, NULL, colorBuffer, (int)(colorBufferPitch * sizeof(uint32_t))
+        );
+    }
+
+    SDL_RenderCopy(renderer, colorBufferTexture, NULL, NULL);
+}
+
+/**
+ * Fill a row of 32-bit values with 16-byte wide stores
+ * Streaming (non-temporal) stores bypass the cache, for memory that is not read again soon.
+ */
+static void fillRow(uint32_t* row, int count, uint32_t value, bool streaming) {
+    int i = 0;
+
+#ifdef HAS_SSE2
+    for (; i < count && ((uintptr_t)&row[i] & 15) != 0; i++) {
+        row[i] = value;
+    }
+
+    __m128i values = _mm_set1_epi32((int)value);
+
+    if (streaming) {
+        for (; i + 4 <= count; i += 4) { _mm_stream_si128((__m128i*)&row[i], values); }
+    } else {
+        for (; i + 4 <= count; i += 4) { _mm_store_si128((__m128i*)&row[i], values); }
+    }
+#else
+    (void)streaming;
+#endif
+
+    for (; i < count; i++) {
+        row[i] = value;
+    }
+}
+
+static void fillRowFloat(float* row, int count, float value) {
+    int i = 0;
+
+#ifdef HAS_SSE2
+    for (; i < count && ((uintptr_t)&row[i] & 15) != 0; i++) {
+        row[i] = value;
+    }
+
+    __m128 values = _mm_set1_ps(value);
+
+    for (; i + 4 <= count; i += 4) { _mm_store_ps(&row[i], values); }
+#endif
+
+    for (; i < count; i++) {
+        row[i] = value;
+    }
+}
+
+void clearColorBuffer(uint32_t color) {
+    clearColorBufferRect(0, 0, windowWidth - 1, windowHeight - 1, color, true);
 }
 
 void clearZBuffer() {
-    for (int y = 0; y < windowHeight; y++) {
-        for (int x = 0; x < windowWidth; x++) {
-            zBuffer[(windowWidth * y) + x] = 1.0;
-        }
+    clearZBufferRect(0, 0, windowWidth - 1, windowHeight - 1);
+}
+
+void clearColorBufferRect(int minX, int minY, int maxX, int maxY, uint32_t color, bool streaming) {
+    for (int y = minY; y <= maxY; y++) {
+        fillRow(&colorBuffer[(colorBufferPitch * y) + minX], maxX - minX + 1, color, streaming);
     }
+
+#ifdef HAS_SSE2
+    /* Make the streaming stores visible before another thread presents the buffer */
+    if (streaming) { _mm_sfence(); }
+#endif
+}
+
+void clearZBufferRect(int minX, int minY, int maxX, int maxY) {
+    for (int y = minY; y <= maxY; y++) {
+        fillRowFloat(&zBuffer[(colorBufferPitch * y) + minX], maxX - minX + 1, 1.0f);
+    }
+}
+
+void destroyColorBuffer() {
+    free(colorBuffer);
+    free(zBuffer);
+    colorBuffer = NULL;
+    zBuffer = NULL;
 }
 
 void destroyWindow() {
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    if (renderer) { SDL_DestroyRenderer(renderer); }
+    if (window) { SDL_DestroyWindow(window); }
+    if (offscreenSurface) { SDL_FreeSurface(offscreenSurface); }
+    renderer = NULL;
+    window = NULL;
+    offscreenSurface = NULL;
     SDL_Quit();
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include <stdio.h>
+
+#include "display.h"
+#include "loader.h"
+
+typedef struct {
+    asset_loader_t load;
+    char* file;
+    bool loaded;
+} asset_load_t;
+
+static asset_load_t assetLoads[MAX_ASSET_LOADS];
+static int numAssetLoads = 0;
+
+/**
+ * Every thread (the calling one included) claims the next queued load through 'nextAssetLoad'
+ * until none are left
+ */
+static SDL_atomic_t nextAssetLoad;
+
+bool queueAssetLoad(asset_loader_t load, char* file)
+{
+    if (numAssetLoads >= MAX_ASSET_LOADS) {
+        fprintf(stderr, "Too Many Asset Loads Queued.\n");
+        return false;
+    }
+
+    assetLoads[numAssetLoads].load = load;
+    assetLoads[numAssetLoads].file = file;
+    assetLoads[numAssetLoads].loaded = false;
+    numAssetLoads++;
+
+    return true;
+}
+
+static void runClaimedAssetLoads(void)
+{
+    while (true) {
+        int index = SDL_AtomicAdd(&nextAssetLoad, 1);
+
+        if (index >= numAssetLoads) { break; }
+
+        assetLoads[index].loaded = assetLoads[index].load(assetLoads[index].file);
+    }
+}
+
+static int assetLoadWorker(void* data)
+{
+    (void)data;
+
+    runClaimedAssetLoads();
+
+    return 0;
+}
+
+bool loadQueuedAssets(int numThreads)
+{
+    SDL_Thread* workers[MAX_ASSET_LOADS];
+    int numWorkers = 0;
+
+    SDL_AtomicSet(&nextAssetLoad, 0);
+
+    /* No more threads than loads; if a worker cannot be created the others take over its share */
+    if (numThreads > numAssetLoads) { numThreads = numAssetLoads; }
+
+    for (numWorkers = 0; numWorkers < numThreads - 1; numWorkers++) {
+        workers[numWorkers] = SDL_CreateThread(assetLoadWorker, "AssetLoader", NULL);
+
+        if (!workers[numWorkers]) {
+            fprintf(stderr, "Error Creating Asset Loader Thread.\n");
+            break;
+        }
+    }
+
+    runClaimedAssetLoads();
+
+    /* Completion barrier: every load has finished (and its results are visible) once the workers are joined */
+    for (int i = 0; i < numWorkers; i++) {
+        SDL_WaitThread(workers[i], NULL);
+    }
+
+    bool loaded = true;
+
+    for (int i = 0; i < numAssetLoads; i++) {
+        loaded = loaded && assetLoads[i].loaded;
+    }
+
+    numAssetLoads = 0;
+
+    return loaded;
+}
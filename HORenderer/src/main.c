@@ -1,72 +1,54 @@
-#include "array.h"
 #include "display.h"
-#include "vector.h"
-#include "mesh.h"
-#include "light.h"
-#include "triangle.h"
-#include "texture.h"
-#include "matrix.h"
-#include "upng.h"
+#include "loader.h"
+#include "pipeline.h"
+#include "profiler.h"
 
 /**
- * Global variables for execution status and game loop
+ * Default assets, next to the sources unless the build says otherwise
+ * Both can be overridden on the command line: HORenderer [mesh.obj|mesh.mesh] [texture.png]
  */
-bool isRunning = false;
-int previousFrameTime = 0;
-vec3_t cameraPosition = {0, 0, 0};
+#ifndef ASSETS_DIR
+#define ASSETS_DIR  "assets/"
+#endif
 
 /**
- * Array to store triangles that should be rendered each frame
+ * Written by the 't' key from the profiler's recorded frames (open it in chrome://tracing)
  */
-#define MAX_TRIANGLES           10000
-triangle_t trianglesToRender[MAX_TRIANGLES];
-int numTrianglesToRender = 0;
+#define TRACE_FILE  "horenderer_trace.json"
 
 /**
- * Global Transformation Matrices
+ * Global variables for execution status and game loop
  */
-mat4_t worldMatrix;
-mat4_t projectMatrix;
+bool isRunning = false;
+int previousFrameTime = 0;
 
-bool setup(void)
+/**
+ * The precompiled binary mesh first, the OBJ file it is built from otherwise
+ */
+static bool loadDefaultMesh(char* meshFile)
+{
+    return loadMesh(meshFile) || loadMesh(ASSETS_DIR "f22.obj");
+}
+
+bool setup(int argc, char* argv[])
 {
     /* Initialize render mode and triangle culling method */
     RenderMethod = RENDER_WIRE;
     CullMethod = CULL_BACKFACE;
 
-    /* Allocate the required bytes in memory for the color buffer and the z-buffer */
-    colorBuffer = (uint32_t*)malloc(sizeof(uint32_t) * windowWidth * windowHeight);
-    zBuffer = (float*)malloc(sizeof(float) * windowWidth * windowHeight);
-
-    if (!colorBuffer) {
-        fprintf(stderr, "Allocating Color Buffer Failed.\n");
-        return false;
-    }
-
-    colorBufferTexture = SDL_CreateTexture(
-        renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING,
-        windowWidth, windowHeight
-    );
+    /* The profiler and its HUD are toggled with the 'p' key */
+    initializeProfiler(false);
 
-    if (!colorBufferTexture) {
-        fprintf(stderr, "Error Creating SDL Texture.\n");
+    /* Start the tile rasterizer with one thread per CPU core */
+    if (!initializePipeline(SDL_GetCPUCount())) {
         return false;
     }
 
-    /* Initialize the perspective projection matrix */
-    float fov = M_PI / 3.0;
-    float aspect = ((float)windowHeight / (float)windowWidth);
-    float znear = 0.1;
-    float zfar = 100.0;
-    projectMatrix = mat4_make_perspective(fov, aspect, znear, zfar);
+    /* Load the mesh and the texture (from an external PNG file) at the same time */
+    queueAssetLoad((argc > 1) ? loadMesh : loadDefaultMesh, (argc > 1) ? argv[1] : ASSETS_DIR "f22.mesh");
+    queueAssetLoad(load_png_texture_data, (argc > 2) ? argv[2] : ASSETS_DIR "f22.png");
 
-    /* Load the vertex and face values for the mesh data structure */
-    load_obj_file_data("C:/Users/hojoon/Developer/game_study/HORenderer/assets/f22.obj");
-
-    /* Load the texture information from an external PNG file */
-    load_png_texture_data("C:/Users/hojoon/Developer/game_study/HORenderer/assets/f22.png");
-
-    return true;
+    return loadQueuedAssets(SDL_GetCPUCount());
 }
 
 void process_input(void)
@@ -111,6 +93,10 @@ void process_input(void)
             {
                 RenderMethod = RENDER_TEXTURED_WIRE;
             }
+            if (event.key.keysym.sym == SDLK_7)
+            {
+                RenderMethod = RENDER_OVERDRAW;
+            }
             if (event.key.keysym.sym == SDLK_c)
             {
                 CullMethod = CULL_BACKFACE;
@@ -119,6 +105,27 @@ void process_input(void)
             {
                 CullMethod = CULL_NONE;
             }
+            if (event.key.keysym.sym == SDLK_f)
+            {
+                FilterMethod = (FilterMethod == FILTER_MIP_BILINEAR) ? FILTER_NEAREST : (enum FilterMethod)(FilterMethod + 1);
+            }
+            if (event.key.keysym.sym == SDLK_g)
+            {
+                ShadeMethod = (ShadeMethod == SHADE_FLAT) ? SHADE_GOURAUD : SHADE_FLAT;
+            }
+            if (event.key.keysym.sym == SDLK_o)
+            {
+                SortMethod = (SortMethod == SORT_NONE) ? SORT_FRONT_TO_BACK : SORT_NONE;
+            }
+            if (event.key.keysym.sym == SDLK_p)
+            {
+                profilerEnabled = !profilerEnabled;
+                profilerHudVisible = profilerEnabled;
+            }
+            if (event.key.keysym.sym == SDLK_t && profilerEnabled)
+            {
+                writeProfilerTrace(TRACE_FILE);
+            }
             
             break;
     }
@@ -132,201 +139,36 @@ void update(void)
     if (timeToWait > 0 && timeToWait <= FRAME_TARGET_TIME) { SDL_Delay(timeToWait); }
 
     previousFrameTime = SDL_GetTicks();
-    numTrianglesToRender = 0;
-
-    // Change the mesh scale/rotation values per animation frame
-    mesh.rotation.x += 0.01f;
-    mesh.rotation.y += 0.01f;
-    mesh.rotation.z += 0.01f;
-    mesh.translation.z = 5.0f;
-
-    // Create a scale, rotation and translation matrix that will be used to multiply the mesh vertices
-    mat4_t scaleMatrix = mat4_make_scale(mesh.scale.x, mesh.scale.y, mesh.scale.z);
-    mat4_t translationMatrix = mat4_make_translation(mesh.translation.x, mesh.translation.y, mesh.translation.z);
-    mat4_t rotationMatrixX = mat4_make_rotation_x(mesh.rotation.x);
-    mat4_t rotationMatrixY = mat4_make_rotation_y(mesh.rotation.y);
-    mat4_t rotationMatrixZ = mat4_make_rotation_z(mesh.rotation.z);
-
-    int num_faces = array_length(mesh.faces);
-
-    for (int i = 0; i < num_faces; i++) {
-        face_t meshFace = mesh.faces[i];
-        vec3_t faceVertices[3];
-
-        /**
-         * Fix here?
-         */
-        faceVertices[0] = mesh.vertices[meshFace.a];
-        faceVertices[1] = mesh.vertices[meshFace.b];
-        faceVertices[2] = mesh.vertices[meshFace.c];
-
-        vec4_t transformedVertices[3];
-
-        // Loop all three vertices of this current face and apply transformations
-        for (int j = 0; j < 3; j++) {
-            vec4_t transformed_vertex = vec4_from_vec3(faceVertices[j]);
-
-            // Create a World Matrix combining scale, rotation, and translation matrices
-            mat4_t worldMatrix = mat4_identity();
-
-            // Order matters : First scale, then rotate, the translate. 
-            // [T] * [R] * [S] * v
-            worldMatrix = mat4_multiply_mat4(scaleMatrix, worldMatrix);
-            worldMatrix = mat4_multiply_mat4(rotationMatrixZ, worldMatrix);
-            worldMatrix = mat4_multiply_mat4(rotationMatrixY, worldMatrix);
-            worldMatrix = mat4_multiply_mat4(rotationMatrixX, worldMatrix);
-            worldMatrix = mat4_multiply_mat4(translationMatrix, worldMatrix);
 
-            // Multiply the world matrix by the original 
-            transformed_vertex = mat4_multiply_vec4(worldMatrix, transformed_vertex);
-
-            // Save transformed vertex in the array of transformed vertices
-            transformedVertices[j] = transformed_vertex;
-        }
-        
-        vec3_t vectorA = vec3_from_vec4(transformedVertices[0]);
-        vec3_t vectorB = vec3_from_vec4(transformedVertices[1]);
-        vec3_t vectorC = vec3_from_vec4(transformedVertices[2]);
-        vec3_t vectorAB = vec3_sub(vectorB, vectorA);
-        vec3_t vectorAC = vec3_sub(vectorC, vectorA);
-
-        vec3_normalize(&vectorAB);
-        vec3_normalize(&vectorAC);
-
-        /* Compute the face normal (using cross product to find perpendicular) */
-        vec3_t normal = vec3_cross(vectorAB, vectorAC);
-        vec3_normalize(&normal);
-
-        /* Find the vector between vertex A in the triangle and the camera origin */
-        vec3_t cameraRay = vec3_sub(cameraPosition, vectorA);
-
-        /* Calculate how aligned the camera ray is with the face normal */
-        float dotNormalCamera = vec3_dot(normal, cameraRay);
-
-        /* Backface culling test to see if the current face should be projected */
-        if (CullMethod == CULL_BACKFACE) {
-            if (dotNormalCamera < 0) { continue; }
-        }
-
-        vec4_t projectedPoints[3];
-
-        /* Loop all three vertices to perform projection and conversion to screen space */
-        for (int j = 0; j < 3; j++) {
-            /* Project the current Vertex */
-            projectedPoints[j] = mat4_multiply_vec4_project(projectMatrix, transformedVertices[j]);
-
-            /**
-             * Flip vertically since the y values of the 3D mesh grow bottom->up and in screen space
-             * y values grow top->down
-             */
-            projectedPoints[i].y *= -1;
-            
-            /* Scale into the view */
-            projectedPoints[j].x *= (windowWidth / 2.0);
-            projectedPoints[j].y *= (windowHeight / 2.0);
-
-            /* Translate the projected points to the middle of the screen */
-            projectedPoints[j].x += (windowWidth / 2.0);
-            projectedPoints[j].y += (windowHeight / 2.0);
-        }
-        
-        float lightIntensityFactor = -vec3_dot(normal, light.direction);
-        uint32_t triangleColor = light_apply_intensity(meshFace.color, lightIntensityFactor);
-        triangle_t projectedTriangle = {
-            .points = {
-                projectedPoints[0].x, projectedPoints[0].y, projectedPoints[0].z, projectedPoints[0].w,
-                projectedPoints[1].x, projectedPoints[1].y, projectedPoints[1].z, projectedPoints[1].w,
-                projectedPoints[2].x, projectedPoints[2].y, projectedPoints[2].z, projectedPoints[2].w
-            },
-            .texcoords = {
-                { meshFace.a_uv.u, meshFace.a_uv.v },
-                { meshFace.b_uv.u, meshFace.b_uv.v },
-                { meshFace.c_uv.u, meshFace.c_uv.v }
-            },
-            .color = triangleColor
-        };
-
-        /* Save the projected triangle in the array of triangles to render */
-        if (numTrianglesToRender < MAX_TRIANGLES) { trianglesToRender[numTrianglesToRender++] = projectedTriangle; }
-    }
+    transformFrame();
 }
 
 void render(void)
 {
-    SDL_RenderClear(renderer);
-
-    draw_grid(0xFF333333);
-    
-    /* Loop all projected triangles and render */
-    for (int i = 0; i < numTrianglesToRender; i++) {
-        triangle_t triangle = trianglesToRender[i];
-
-        /* Draw Filled Triangle */
-        if (RenderMethod == RENDER_FILL_TRIANGLE || RenderMethod == RENDER_FILL_TRIANGLE_WIRE) {
-            draw_filled_triangle(
-                (int)triangle.points[0].x, (int)triangle.points[0].y, triangle.points[0].z, triangle.points[0].w,
-                (int)triangle.points[1].x, (int)triangle.points[1].y, triangle.points[1].z, triangle.points[1].w,
-                (int)triangle.points[2].x, (int)triangle.points[2].y, triangle.points[2].z, triangle.points[2].w,
-                triangle.color);
-        }
-
-        /* Draw Textured Triangle */
-        if (RenderMethod == RENDER_TEXTURED || RenderMethod == RENDER_TEXTURED_WIRE) {
-            draw_textured_triangle(
-                (int)triangle.points[0].x, (int)triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, triangle.texcoords[0].u, triangle.texcoords[0].v,
-                (int)triangle.points[1].x, (int)triangle.points[1].y, triangle.points[1].z, triangle.points[1].w, triangle.texcoords[1].u, triangle.texcoords[1].v,
-                (int)triangle.points[2].x, (int)triangle.points[2].y, triangle.points[2].z, triangle.points[2].w, triangle.texcoords[2].u, triangle.texcoords[2].v,
-                mesh_texture
-            );
-        }
-
-        /* Draw Triangle Wireframe */
-        if (RenderMethod == RENDER_WIRE || RenderMethod == RENDER_WIRE_VERTEX || RenderMethod == RENDER_FILL_TRIANGLE_WIRE || RenderMethod == RENDER_TEXTURED_WIRE) {
-            draw_triangle(
-                (int)triangle.points[0].x, (int)triangle.points[0].y,
-                (int)triangle.points[1].x, (int)triangle.points[1].y,
-                (int)triangle.points[2].x, (int)triangle.points[2].y,
-                0xFFFFFFFF);
-        }
-
-        /* Draw Triangle Vertex Points */
-        if (RenderMethod == RENDER_WIRE_VERTEX) {
-            draw_rectangle(triangle.points[0].x - 3, triangle.points[0].y - 3, 6, 6, 0xFFFF0000);
-            draw_rectangle(triangle.points[1].x - 3, triangle.points[1].y - 3, 6, 6, 0xFFFF0000);
-            draw_rectangle(triangle.points[2].x - 3, triangle.points[2].y - 3, 6, 6, 0xFFFF0000);
-        }
-    }
-    
-    render_color_buffer();
-
-    clear_color_buffer(0xFF000000);
-    clear_z_buffer();
-    
-    SDL_RenderPresent(renderer);
-}
-
-void free_resources(void)
-{
-    free(colorBuffer);
-    free(zBuffer);
-    upng_free(png_texture);
-    array_free(mesh.vertices);
-    array_free(mesh.faces);
+    rasterizeFrame();
+    presentFrame();
 }
 
 int main(int argc, char* argv[])
 {
-    isRunning = initialize_window();
-    isRunning = setup();
+    isRunning = initializeWindow();
+    isRunning = isRunning && setup(argc, argv);
 
     while (isRunning) {
-        process_input();
+        beginProfileFrame();
+
+        PROFILE_SCOPE(PROFILE_INPUT) {
+            process_input();
+        }
+
         update();
         render();
+
+        endProfileFrame();
     }
     
-    destroy_window();
-    free_resources();
+    destroyPipeline();
+    destroyWindow();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,103 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool map_file(const char* filename, map_access_t access, mapped_file_t* file)
+{
+    file->data = NULL;
+    file->size = 0;
+    file->file_handle = NULL;
+    file->mapping_handle = NULL;
+
+#ifdef _WIN32
+    DWORD flags = (access == MAP_ACCESS_SEQUENTIAL) ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL;
+    HANDLE file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+
+    if (file_handle == INVALID_HANDLE_VALUE) { return false; }
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(file_handle, &size)) {
+        CloseHandle(file_handle);
+        return false;
+    }
+
+    file->file_handle = file_handle;
+    file->size = (size_t)size.QuadPart;
+
+    /* Empty files cannot be mapped, they are returned as a valid zero-sized view */
+    if (file->size == 0) { return true; }
+
+    HANDLE mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (mapping_handle == NULL) {
+        unmap_file(file);
+        return false;
+    }
+
+    file->mapping_handle = mapping_handle;
+    file->data = (const unsigned char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+
+    if (file->data == NULL) {
+        unmap_file(file);
+        return false;
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) { return false; }
+
+    struct stat status;
+
+    if (fstat(fd, &status) != 0) {
+        close(fd);
+        return false;
+    }
+
+    file->size = (size_t)status.st_size;
+
+    if (file->size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* The mapping keeps the file referenced, the descriptor is not needed anymore */
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        file->size = 0;
+        return false;
+    }
+
+    if (access == MAP_ACCESS_SEQUENTIAL) { madvise(data, file->size, MADV_SEQUENTIAL); }
+    file->data = (const unsigned char*)data;
+#endif
+
+    return true;
+}
+
+void unmap_file(mapped_file_t* file)
+{
+#ifdef _WIN32
+    if (file->data) { UnmapViewOfFile(file->data); }
+    if (file->mapping_handle) { CloseHandle((HANDLE)file->mapping_handle); }
+    if (file->file_handle) { CloseHandle((HANDLE)file->file_handle); }
+#else
+    if (file->data) { munmap((void*)file->data, file->size); }
+#endif
+
+    file->data = NULL;
+    file->size = 0;
+    file->file_handle = NULL;
+    file->mapping_handle = NULL;
+}
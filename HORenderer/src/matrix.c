@@ -1,6 +1,7 @@
 #include <math.h>
 
 #include "matrix.h"
+#include "simd.h"
 
 mat4_t mat4_identity(void) 
 {
@@ -138,32 +139,133 @@ mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar)
     return projectionMatrix;
 }
 
-vec4_t mat4_multiply_vec4(mat4_t m, vec4_t v)
+mat4_t mat4_make_normal(const mat4_t* m)
+{
+    /**
+     * Normal matrix of the upper 3x3 part of 'm' (the translation is dropped)
+     * The cofactor matrix C = det(M) * transpose(inverse(M)) maps the cross product of two edges to the
+     * cross product of the transformed edges, so normals keep the winding of their triangle (what backface
+     * culling tests), even for mirroring matrices. Dividing it by |det(M)|^(2/3) keeps unit normals unit
+     * under rotation and uniform scale.
+     */
+    mat4_t normalMatrix = mat4_identity();
+
+    for (int i = 0; i < 3; i++) {
+        int i1 = (i + 1) % 3;
+        int i2 = (i + 2) % 3;
+
+        for (int j = 0; j < 3; j++) {
+            int j1 = (j + 1) % 3;
+            int j2 = (j + 2) % 3;
+
+            normalMatrix.m[i][j] = (m->m[i1][j1] * m->m[i2][j2]) - (m->m[i1][j2] * m->m[i2][j1]);
+        }
+    }
+
+    float determinant = (m->m[0][0] * normalMatrix.m[0][0]) + (m->m[0][1] * normalMatrix.m[0][1]) + (m->m[0][2] * normalMatrix.m[0][2]);
+
+    if (determinant != 0.0f) {
+        float scale = cbrtf(fabsf(determinant));
+
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                normalMatrix.m[i][j] /= scale * scale;
+            }
+        }
+    }
+
+    return normalMatrix;
+}
+
+#ifdef HAS_SSE2
+/**
+ * Columns of a matrix: m * v is the sum of the columns scaled by the components of v,
+ * added in the order of the scalar dot products so both give the same results
+ */
+static inline void load_columns(const mat4_t* m, __m128 columns[4])
+{
+    __m128 row0 = _mm_loadu_ps(m->m[0]);
+    __m128 row1 = _mm_loadu_ps(m->m[1]);
+    __m128 row2 = _mm_loadu_ps(m->m[2]);
+    __m128 row3 = _mm_loadu_ps(m->m[3]);
+
+    _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+
+    columns[0] = row0;
+    columns[1] = row1;
+    columns[2] = row2;
+    columns[3] = row3;
+}
+
+/**
+ * m * (x, y, z, 1)
+ */
+static inline __m128 transform_point(const __m128 columns[4], float x, float y, float z)
+{
+    __m128 result = _mm_add_ps(_mm_mul_ps(columns[0], _mm_set1_ps(x)), _mm_mul_ps(columns[1], _mm_set1_ps(y)));
+
+    result = _mm_add_ps(result, _mm_mul_ps(columns[2], _mm_set1_ps(z)));
+
+    return _mm_add_ps(result, columns[3]);
+}
+#endif
+
+vec4_t mat4_multiply_vec4(const mat4_t* m, vec4_t v)
 {
     vec4_t result;
 
-    result.x = (m.m[0][0] * v.x) + (m.m[0][1] * v.y) + (m.m[0][2] * v.z) + (m.m[0][3] * v.w);
-    result.y = (m.m[1][0] * v.x) + (m.m[1][1] * v.y) + (m.m[1][2] * v.z) + (m.m[1][3] * v.w);
-    result.z = (m.m[2][0] * v.x) + (m.m[2][1] * v.y) + (m.m[2][2] * v.z) + (m.m[2][3] * v.w);
-    result.w = (m.m[3][0] * v.x) + (m.m[3][1] * v.y) + (m.m[3][2] * v.z) + (m.m[3][3] * v.w);
+#ifdef HAS_SSE2
+    __m128 columns[4];
+
+    load_columns(m, columns);
+
+    __m128 sum = _mm_add_ps(_mm_mul_ps(columns[0], _mm_set1_ps(v.x)), _mm_mul_ps(columns[1], _mm_set1_ps(v.y)));
+
+    sum = _mm_add_ps(sum, _mm_mul_ps(columns[2], _mm_set1_ps(v.z)));
+    sum = _mm_add_ps(sum, _mm_mul_ps(columns[3], _mm_set1_ps(v.w)));
+
+    _mm_storeu_ps(&result.x, sum);
+#else
+    result.x = (m->m[0][0] * v.x) + (m->m[0][1] * v.y) + (m->m[0][2] * v.z) + (m->m[0][3] * v.w);
+    result.y = (m->m[1][0] * v.x) + (m->m[1][1] * v.y) + (m->m[1][2] * v.z) + (m->m[1][3] * v.w);
+    result.z = (m->m[2][0] * v.x) + (m->m[2][1] * v.y) + (m->m[2][2] * v.z) + (m->m[2][3] * v.w);
+    result.w = (m->m[3][0] * v.x) + (m->m[3][1] * v.y) + (m->m[3][2] * v.z) + (m->m[3][3] * v.w);
+#endif
 
     return result;
 }
 
-mat4_t mat4_multiply_mat4(mat4_t a, mat4_t b)
+void mat4_multiply_mat4(const mat4_t* a, const mat4_t* b, mat4_t* result)
 {
-    mat4_t result;
+#ifdef HAS_SSE2
+    /* Row i of the result is the sum of the rows of b scaled by row i of a; every row is computed before any is stored */
+    __m128 rowsB[4] = { _mm_loadu_ps(b->m[0]), _mm_loadu_ps(b->m[1]), _mm_loadu_ps(b->m[2]), _mm_loadu_ps(b->m[3]) };
+    __m128 rows[4];
+
+    for (int i = 0; i < 4; i++) {
+        __m128 row = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a->m[i][0]), rowsB[0]), _mm_mul_ps(_mm_set1_ps(a->m[i][1]), rowsB[1]));
+
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[i][2]), rowsB[2]));
+        rows[i] = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[i][3]), rowsB[3]));
+    }
+
+    for (int i = 0; i < 4; i++) {
+        _mm_storeu_ps(result->m[i], rows[i]);
+    }
+#else
+    mat4_t product;
 
     for (int i = 0; i < 4; i++) {
         for (int j = 0; j < 4; j++) {
-            result.m[i][j] = (a.m[i][0] * b.m[0][j]) + (a.m[i][1] * b.m[1][j]) + (a.m[i][2] * b.m[2][j]) + (a.m[i][3] * b.m[3][j]);
+            product.m[i][j] = (a->m[i][0] * b->m[0][j]) + (a->m[i][1] * b->m[1][j]) + (a->m[i][2] * b->m[2][j]) + (a->m[i][3] * b->m[3][j]);
         }
     }
 
-    return result;
+    *result = product;
+#endif
 }
 
-vec4_t mat4_multiply_vec4_project(mat4_t projectionMatrix, vec4_t v)
+vec4_t mat4_multiply_vec4_project(const mat4_t* projectionMatrix, vec4_t v)
 {
     /* Multiplication by the Projection Matrix */
     vec4_t result = mat4_multiply_vec4(projectionMatrix, v);
@@ -179,4 +281,84 @@ vec4_t mat4_multiply_vec4_project(mat4_t projectionMatrix, vec4_t v)
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+void mat4_transform_vec3_array(const mat4_t* m, const vec3_t* in, vec4_t* out, size_t count)
+{
+#ifdef HAS_SSE2
+    __m128 columns[4];
+
+    load_columns(m, columns);
+
+    for (size_t i = 0; i < count; i++) {
+        _mm_storeu_ps(&out[i].x, transform_point(columns, in[i].x, in[i].y, in[i].z));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        out[i] = mat4_multiply_vec4(m, vec4_from_vec3(in[i]));
+    }
+#endif
+}
+
+void mat4_transform_dir3_array(const mat4_t* m, const vec3_t* in, vec3_t* out, size_t count)
+{
+#ifdef HAS_SSE2
+    __m128 columns[4];
+
+    load_columns(m, columns);
+
+    /* The w term is column 3 scaled by 0, it is still added so the results match mat4_multiply_vec4() */
+    __m128 wTerm = _mm_mul_ps(columns[3], _mm_setzero_ps());
+
+    for (size_t i = 0; i < count; i++) {
+        __m128 sum = _mm_add_ps(_mm_mul_ps(columns[0], _mm_set1_ps(in[i].x)), _mm_mul_ps(columns[1], _mm_set1_ps(in[i].y)));
+
+        sum = _mm_add_ps(sum, _mm_mul_ps(columns[2], _mm_set1_ps(in[i].z)));
+        sum = _mm_add_ps(sum, wTerm);
+
+        /* vec3_t is 12 bytes: x and y, then z, so the store does not run past the last element */
+        _mm_storel_pi((__m64*)&out[i].x, sum);
+        _mm_store_ss(&out[i].z, _mm_movehl_ps(sum, sum));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        out[i] = vec3_from_vec4(mat4_multiply_vec4(m, (vec4_t){ in[i].x, in[i].y, in[i].z, 0.0f }));
+    }
+#endif
+}
+
+void mat4_project_vec3_array(const mat4_t* m, const vec3_t* in, vec4_t* out, size_t count, float width, float height)
+{
+    float halfWidth = width / 2.0f;
+    float halfHeight = height / 2.0f;
+
+#ifdef HAS_SSE2
+    __m128 columns[4];
+
+    load_columns(m, columns);
+
+    /* x * w/2 + w/2 and -y * h/2 + h/2 (flipped, screen y grows down); z is left as is (-0 is the identity of addition) */
+    __m128 scale = _mm_setr_ps(halfWidth, -halfHeight, 1.0f, 1.0f);
+    __m128 offset = _mm_setr_ps(halfWidth, halfHeight, -0.0f, -0.0f);
+    __m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+
+    for (size_t i = 0; i < count; i++) {
+        __m128 point = transform_point(columns, in[i].x, in[i].y, in[i].z);
+        __m128 projected = _mm_div_ps(point, _mm_shuffle_ps(point, point, _MM_SHUFFLE(3, 3, 3, 3)));
+
+        projected = _mm_add_ps(_mm_mul_ps(projected, scale), offset);
+
+        /* w keeps the view depth for the perspective correct interpolation */
+        _mm_storeu_ps(&out[i].x, _mm_or_ps(_mm_and_ps(xyzMask, projected), _mm_andnot_ps(xyzMask, point)));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        vec4_t point = mat4_multiply_vec4(m, vec4_from_vec3(in[i]));
+
+        out[i].x = ((point.x / point.w) * halfWidth) + halfWidth;
+        out[i].y = ((point.y / point.w) * -halfHeight) + halfHeight;
+        out[i].z = point.z / point.w;
+        out[i].w = point.w;
+    }
+#endif
+}
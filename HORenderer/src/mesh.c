@@ -1,15 +1,27 @@
 #include <stdio.h>
-#include <string.h>
+#include <stdint.h>
+#include <math.h>
 
 #include "array.h"
+#include "mapped_file.h"
 #include "mesh.h"
 
 mesh_t mesh = {
     .vertices = NULL,
     .faces = NULL,
+    .normals = NULL,
+    .face_normals = NULL,
+    .num_vertices = 0,
+    .num_faces = 0,
+    .num_normals = 0,
+    .mapping = { NULL, 0, NULL, NULL },
     .rotation = {0, 0, 0},
     .scale = {1.0, 1.0, 1.0},
-    .translation = {0, 0, 0}
+    .translation = {0, 0, 0},
+    .world_vertices = NULL,
+    .clip_vertices = NULL,
+    .world_normals = NULL,
+    .world_face_normals = NULL
 };
 
 vec3_t cube_vertices[N_CUBE_VERTICES] = {
@@ -44,8 +56,83 @@ face_t cube_faces[N_CUBE_FACES] = {
     { .a = 6, .b = 1, .c = 4, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 }, .color = 0xFFFFFFFF }
 };
 
+/**
+ * Unit vector of 'v', degenerate (zero length) vectors stay zero
+ */
+static vec3_t unit_vector(vec3_t v)
+{
+    float length = vec3_length(v);
+
+    return (length > 0.0f) ? vec3_div(v, length) : v;
+}
+
+/**
+ * Load-time normals of an array-backed mesh
+ * Face normals are computed from the positions. Face corners without a vertex normal (-1) get the smooth
+ * normal of their vertex: the sum of the normals of the faces around it, weighted by their area.
+ */
+static void compute_mesh_normals(void)
+{
+    int num_vertices = array_length(mesh.vertices);
+    int num_faces = array_length(mesh.faces);
+    bool missing_normals = false;
+
+    array_clear(mesh.face_normals);
+    mesh.face_normals = array_hold(mesh.face_normals, num_faces, sizeof(vec3_t));
+
+    for (int i = 0; i < num_faces; i++) {
+        face_t* face = &mesh.faces[i];
+        vec3_t edge_ab = vec3_sub(mesh.vertices[face->b], mesh.vertices[face->a]);
+        vec3_t edge_ac = vec3_sub(mesh.vertices[face->c], mesh.vertices[face->a]);
+
+        mesh.face_normals[i] = unit_vector(vec3_cross(edge_ab, edge_ac));
+
+        if (face->a_normal < 0 || face->b_normal < 0 || face->c_normal < 0) { missing_normals = true; }
+    }
+
+    if (missing_normals) {
+        int normal_base = array_length(mesh.normals);
+
+        mesh.normals = array_hold(mesh.normals, num_vertices, sizeof(vec3_t));
+
+        vec3_t* smooth_normals = &mesh.normals[normal_base];
+
+        for (int i = 0; i < num_vertices; i++) {
+            smooth_normals[i] = (vec3_t){ 0, 0, 0 };
+        }
+
+        /* Unnormalized cross products: their length is twice the area of the face */
+        for (int i = 0; i < num_faces; i++) {
+            const face_t* face = &mesh.faces[i];
+            vec3_t edge_ab = vec3_sub(mesh.vertices[face->b], mesh.vertices[face->a]);
+            vec3_t edge_ac = vec3_sub(mesh.vertices[face->c], mesh.vertices[face->a]);
+            vec3_t weighted_normal = vec3_cross(edge_ab, edge_ac);
+
+            smooth_normals[face->a] = vec3_add(smooth_normals[face->a], weighted_normal);
+            smooth_normals[face->b] = vec3_add(smooth_normals[face->b], weighted_normal);
+            smooth_normals[face->c] = vec3_add(smooth_normals[face->c], weighted_normal);
+        }
+
+        for (int i = 0; i < num_vertices; i++) {
+            smooth_normals[i] = unit_vector(smooth_normals[i]);
+        }
+
+        for (int i = 0; i < num_faces; i++) {
+            face_t* face = &mesh.faces[i];
+
+            if (face->a_normal < 0) { face->a_normal = normal_base + face->a; }
+            if (face->b_normal < 0) { face->b_normal = normal_base + face->b; }
+            if (face->c_normal < 0) { face->c_normal = normal_base + face->c; }
+        }
+    }
+
+    mesh.num_normals = array_length(mesh.normals);
+}
+
 void load_cube_mesh_data(void)
 {
+    int vertex_base = array_length(mesh.vertices);
+
     for (int i = 0; i < N_CUBE_VERTICES; i++) {
         vec3_t cube_vertex = cube_vertices[i];
         array_push(mesh.vertices, cube_vertex);
@@ -53,62 +140,665 @@ void load_cube_mesh_data(void)
 
     for (int i = 0; i < N_CUBE_FACES; i++) {
         face_t cube_face = cube_faces[i];
+
+        /* Cube faces index their vertices from 1 and have no vertex normals */
+        cube_face.a += vertex_base - 1;
+        cube_face.b += vertex_base - 1;
+        cube_face.c += vertex_base - 1;
+        cube_face.a_normal = -1;
+        cube_face.b_normal = -1;
+        cube_face.c_normal = -1;
         array_push(mesh.faces, cube_face);
     }
+
+    compute_mesh_normals();
+
+    mesh.num_vertices = array_length(mesh.vertices);
+    mesh.num_faces = array_length(mesh.faces);
 }
 
-void load_obj_file_data(char* filename) {
-    FILE* file;
-    fopen_s(&file, filename, "r");
+/**
+ * OBJ parser state
+ * The file is memory mapped and not NUL terminated, so every helper stops at 'end'
+ */
+typedef struct {
+    const char* cursor;
+    const char* end;
+    const char* filename;
+    int line;
+} obj_parser_t;
 
-    char line[1024];
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-    tex2_t* texcoords = NULL;
+static bool obj_error(obj_parser_t* parser, const char* message)
+{
+    fprintf(stderr, "%s:%d: %s\n", parser->filename, parser->line, message);
+    return false;
+}
 
-    while (fgets(line, 1024, file)) {
-        // Vertex information
-        if (strncmp(line, "v ", 2) == 0) {
-            vec3_t vertex;
-            sscanf(line, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-            array_push(mesh.vertices, vertex);
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static void skip_spaces(obj_parser_t* parser)
+{
+    while (parser->cursor < parser->end && (*parser->cursor == ' ' || *parser->cursor == '\t')) {
+        parser->cursor++;
+    }
+}
+
+static void skip_line(obj_parser_t* parser)
+{
+    while (parser->cursor < parser->end && *parser->cursor != '\n') {
+        parser->cursor++;
+    }
+
+    if (parser->cursor < parser->end) { parser->cursor++; }
+
+    parser->line++;
+}
+
+/* True when only whitespace or a comment is left on the current line */
+static bool at_end_of_line(obj_parser_t* parser)
+{
+    skip_spaces(parser);
+
+    return parser->cursor == parser->end || *parser->cursor == '\n' || *parser->cursor == '\r' || *parser->cursor == '#';
+}
+
+/* Numbers must be followed by whitespace, the end of the line or an index separator */
+static bool at_token_end(obj_parser_t* parser)
+{
+    if (parser->cursor == parser->end) { return true; }
+
+    char c = *parser->cursor;
+
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '#' || c == '/';
+}
+
+/**
+ * Decimal float parser: [+-]digits[.digits][(e|E)[+-]digits]
+ * Up to 18 significant digits are accumulated in an integer mantissa, then scaled once by a power of ten
+ */
+static bool parse_float(obj_parser_t* parser, float* value)
+{
+    const char* c = parser->cursor;
+    const char* end = parser->end;
+    bool negative = false;
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+
+    if (c < end && (*c == '-' || *c == '+')) {
+        negative = (*c == '-');
+        c++;
+    }
+
+    for (; c < end && is_digit(*c); c++, digits++) {
+        if (mantissa < 100000000000000000ULL) { mantissa = (mantissa * 10) + (*c - '0'); }
+        else { exponent++; }
+    }
+
+    if (c < end && *c == '.') {
+        for (c++; c < end && is_digit(*c); c++, digits++) {
+            if (mantissa < 100000000000000000ULL) {
+                mantissa = (mantissa * 10) + (*c - '0');
+                exponent--;
+            }
         }
+    }
+
+    if (digits == 0) { return false; }
+
+    if (c < end && (*c == 'e' || *c == 'E')) {
+        bool negative_exponent = false;
+        int explicit_exponent = 0;
+        int exponent_digits = 0;
+
+        c++;
+
+        if (c < end && (*c == '-' || *c == '+')) {
+            negative_exponent = (*c == '-');
+            c++;
+        }
+
+        for (; c < end && is_digit(*c); c++, exponent_digits++) {
+            if (explicit_exponent < 10000) { explicit_exponent = (explicit_exponent * 10) + (*c - '0'); }
+        }
+
+        if (exponent_digits == 0) { return false; }
+
+        exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+    }
+
+    double result = (double)mantissa;
+
+    if (exponent < 0) {
+        for (; exponent < -22; exponent += 22) { result /= 1e22; }
+        result /= powers_of_ten[-exponent];
+    } else {
+        for (; exponent > 22; exponent -= 22) { result *= 1e22; }
+        result *= powers_of_ten[exponent];
+    }
+
+    parser->cursor = c;
+    *value = (float)(negative ? -result : result);
+
+    return at_token_end(parser);
+}
+
+static bool parse_int(obj_parser_t* parser, int* value)
+{
+    const char* c = parser->cursor;
+    bool negative = false;
+    int result = 0;
+    int digits = 0;
+
+    if (c < parser->end && *c == '-') {
+        negative = true;
+        c++;
+    }
+
+    for (; c < parser->end && is_digit(*c); c++, digits++) {
+        if (result > 100000000) { return false; }
+        result = (result * 10) + (*c - '0');
+    }
+
+    if (digits == 0) { return false; }
+
+    parser->cursor = c;
+    *value = negative ? -result : result;
+
+    return at_token_end(parser);
+}
+
+/**
+ * OBJ indices start at 1, negative indices are relative to the elements read so far
+ */
+static bool resolve_index(int index, int count, int* resolved)
+{
+    if (index > 0 && index <= count) {
+        *resolved = index - 1;
+        return true;
+    }
+
+    if (index < 0 && -index <= count) {
+        *resolved = count + index;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Face corner: v, v/vt, v//vn or v/vt/vn
+ */
+static bool parse_face_corner(obj_parser_t* parser, int num_vertices, int num_texcoords, int num_normals, int* vertex, int* texcoord, int* normal)
+{
+    int index;
+
+    *texcoord = -1;
+    *normal = -1;
+
+    if (!parse_int(parser, &index)) { return obj_error(parser, "malformed face vertex index"); }
+    if (!resolve_index(index, num_vertices, vertex)) { return obj_error(parser, "face vertex index out of range"); }
+
+    if (parser->cursor == parser->end || *parser->cursor != '/') { return true; }
+
+    parser->cursor++;
+
+    if (parser->cursor < parser->end && *parser->cursor != '/') {
+        if (!parse_int(parser, &index)) { return obj_error(parser, "malformed face texture index"); }
+        if (!resolve_index(index, num_texcoords, texcoord)) { return obj_error(parser, "face texture index out of range"); }
+    }
+
+    if (parser->cursor == parser->end || *parser->cursor != '/') { return true; }
+
+    parser->cursor++;
+
+    if (!parse_int(parser, &index)) { return obj_error(parser, "malformed face normal index"); }
+    if (!resolve_index(index, num_normals, normal)) { return obj_error(parser, "face normal index out of range"); }
+
+    return true;
+}
+
+/**
+ * First pass: count the elements so every array is allocated exactly once
+ */
+static void count_obj_elements(obj_parser_t parser, int* num_vertices, int* num_texcoords, int* num_normals, int* num_faces)
+{
+    *num_vertices = 0;
+    *num_texcoords = 0;
+    *num_normals = 0;
+    *num_faces = 0;
+
+    while (parser.cursor < parser.end) {
+        skip_spaces(&parser);
+
+        const char* c = parser.cursor;
+        size_t remaining = (size_t)(parser.end - c);
+
+        if (remaining >= 2 && c[0] == 'v' && (c[1] == ' ' || c[1] == '\t')) {
+            (*num_vertices)++;
+        } else if (remaining >= 3 && c[0] == 'v' && c[1] == 't' && (c[2] == ' ' || c[2] == '\t')) {
+            (*num_texcoords)++;
+        } else if (remaining >= 3 && c[0] == 'v' && c[1] == 'n' && (c[2] == ' ' || c[2] == '\t')) {
+            (*num_normals)++;
+        } else if (remaining >= 2 && c[0] == 'f' && (c[1] == ' ' || c[1] == '\t')) {
+            int corners = 0;
 
-        /**
-         * Texture coordinate information
-         */
-        if (strncmp(line, "vt ", 3) == 0) {
-            tex2_t texcoord;
-            sscanf(line, "vt %f %f", &texcoord.u, &texcoord.v);
-            array_push(texcoords, texcoord);
+            parser.cursor++;
+
+            while (!at_end_of_line(&parser)) {
+                corners++;
+
+                while (parser.cursor < parser.end && *parser.cursor != ' ' && *parser.cursor != '\t' &&
+                       *parser.cursor != '\r' && *parser.cursor != '\n') {
+                    parser.cursor++;
+                }
+            }
+
+            /* A polygon with n corners is triangulated into n - 2 triangles */
+            if (corners > 2) { *num_faces += corners - 2; }
         }
 
-        // Face information
-        if (strncmp(line, "f ", 2) == 0) {
-            
-            int vertex_indices[3];
-            int texture_indices[3];
-            int normal_indices[3];
-            sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d", 
-                &vertex_indices[0], &texture_indices[0], &normal_indices[0], 
-                &vertex_indices[1], &texture_indices[1], &normal_indices[1],
-                &vertex_indices[2], &texture_indices[2], &normal_indices[2]);
-
-                /**
-                 * Texture index start with 1 so have to '-1'
-                 */
-            face_t face = {
-                .a = vertex_indices[0] - 1,
-                .b = vertex_indices[1] - 1,
-                .c = vertex_indices[2] - 1,
-                .a_uv = texcoords[texture_indices[0] - 1],
-                .b_uv = texcoords[texture_indices[1] - 1],
-                .c_uv = texcoords[texture_indices[2] - 1],
-                .color = 0xFFFFFFFF
-            };
-
-            array_push(mesh.faces, face);
+        skip_line(&parser);
+    }
+}
+
+bool load_obj_file_data(char* filename)
+{
+    mapped_file_t file;
+
+    if (!map_file(filename, MAP_ACCESS_SEQUENTIAL, &file)) {
+        fprintf(stderr, "Error opening OBJ file %s.\n", filename);
+        return false;
+    }
+
+    obj_parser_t parser = {
+        .cursor = (const char*)file.data,
+        .end = (const char*)file.data + file.size,
+        .filename = filename,
+        .line = 1
+    };
+
+    int num_vertices;
+    int num_texcoords;
+    int num_normals;
+    int num_faces;
+
+    count_obj_elements(parser, &num_vertices, &num_texcoords, &num_normals, &num_faces);
+
+    /* The mesh arrays may already hold data, the new elements are appended after it */
+    if (mesh.mapping.data) { free_mesh(); }
+
+    int vertex_base = array_length(mesh.vertices);
+    int face_base = array_length(mesh.faces);
+    int normal_base = array_length(mesh.normals);
+
+    mesh.vertices = array_hold(mesh.vertices, num_vertices, sizeof(vec3_t));
+    mesh.faces = array_hold(mesh.faces, num_faces, sizeof(face_t));
+    mesh.normals = array_hold(mesh.normals, num_normals, sizeof(vec3_t));
+    tex2_t* texcoords = array_hold(NULL, num_texcoords, sizeof(tex2_t));
+
+    tex2_t default_texcoord = { 0, 0 };
+    int vertex_count = 0;
+    int texcoord_count = 0;
+    int normal_count = 0;
+    int face_count = 0;
+    bool ok = true;
+
+    while (ok && parser.cursor < parser.end) {
+        skip_spaces(&parser);
+
+        const char* c = parser.cursor;
+        size_t remaining = (size_t)(parser.end - c);
+
+        if (remaining >= 2 && c[0] == 'v' && (c[1] == ' ' || c[1] == '\t')) {
+            // Vertex information
+            vec3_t vertex;
+
+            parser.cursor += 2;
+            skip_spaces(&parser);
+            ok = parse_float(&parser, &vertex.x);
+            skip_spaces(&parser);
+            ok = ok && parse_float(&parser, &vertex.y);
+            skip_spaces(&parser);
+            ok = ok && parse_float(&parser, &vertex.z);
+
+            if (!ok) { obj_error(&parser, "malformed vertex"); break; }
+
+            mesh.vertices[vertex_base + vertex_count++] = vertex;
+        } else if (remaining >= 3 && c[0] == 'v' && c[1] == 't' && (c[2] == ' ' || c[2] == '\t')) {
+            // Texture coordinate information (v is optional)
+            tex2_t texcoord = { 0, 0 };
+
+            parser.cursor += 3;
+            skip_spaces(&parser);
+            ok = parse_float(&parser, &texcoord.u);
+
+            if (ok && !at_end_of_line(&parser)) { ok = parse_float(&parser, &texcoord.v); }
+            if (!ok) { obj_error(&parser, "malformed texture coordinate"); break; }
+
+            texcoords[texcoord_count++] = texcoord;
+        } else if (remaining >= 3 && c[0] == 'v' && c[1] == 'n' && (c[2] == ' ' || c[2] == '\t')) {
+            // Vertex normal information (stored as unit vectors)
+            vec3_t normal;
+
+            parser.cursor += 3;
+            skip_spaces(&parser);
+            ok = parse_float(&parser, &normal.x);
+            skip_spaces(&parser);
+            ok = ok && parse_float(&parser, &normal.y);
+            skip_spaces(&parser);
+            ok = ok && parse_float(&parser, &normal.z);
+
+            if (!ok) { obj_error(&parser, "malformed vertex normal"); break; }
+
+            mesh.normals[normal_base + normal_count++] = unit_vector(normal);
+        } else if (remaining >= 2 && c[0] == 'f' && (c[1] == ' ' || c[1] == '\t')) {
+            // Face information, polygons are triangulated as a fan around their first corner
+            int vertices[3];
+            int uvs[3];
+            int normals[3];
+            int corners = 0;
+
+            parser.cursor += 2;
+
+            while (ok && !at_end_of_line(&parser)) {
+                int slot = (corners < 2) ? corners : 2;
+
+                ok = parse_face_corner(&parser, vertex_count, texcoord_count, normal_count, &vertices[slot], &uvs[slot], &normals[slot]);
+                corners++;
+
+                if (ok && corners >= 3) {
+                    face_t face = {
+                        .a = vertex_base + vertices[0],
+                        .b = vertex_base + vertices[1],
+                        .c = vertex_base + vertices[2],
+                        .a_uv = uvs[0] >= 0 ? texcoords[uvs[0]] : default_texcoord,
+                        .b_uv = uvs[1] >= 0 ? texcoords[uvs[1]] : default_texcoord,
+                        .c_uv = uvs[2] >= 0 ? texcoords[uvs[2]] : default_texcoord,
+                        .a_normal = normals[0] >= 0 ? normal_base + normals[0] : -1,
+                        .b_normal = normals[1] >= 0 ? normal_base + normals[1] : -1,
+                        .c_normal = normals[2] >= 0 ? normal_base + normals[2] : -1,
+                        .color = 0xFFFFFFFF
+                    };
+
+                    mesh.faces[face_base + face_count++] = face;
+
+                    /* The next triangle of the fan starts from the current last edge */
+                    vertices[1] = vertices[2];
+                    uvs[1] = uvs[2];
+                    normals[1] = normals[2];
+                }
+            }
+
+            if (ok && corners < 3) { ok = obj_error(&parser, "face with less than 3 vertices"); }
+            if (!ok) { break; }
         }
+
+        skip_line(&parser);
     }
 
     array_free(texcoords);
-}
\ No newline at end of file
+    unmap_file(&file);
+
+    if (ok) {
+        /* Corners without a 'vn' index get smooth normals */
+        compute_mesh_normals();
+    } else {
+        /* Do not leave a partially parsed mesh behind */
+        array_free(mesh.vertices);
+        array_free(mesh.faces);
+        array_free(mesh.normals);
+        array_free(mesh.face_normals);
+        mesh.vertices = NULL;
+        mesh.faces = NULL;
+        mesh.normals = NULL;
+        mesh.face_normals = NULL;
+    }
+
+    mesh.num_vertices = array_length(mesh.vertices);
+    mesh.num_faces = array_length(mesh.faces);
+    mesh.num_normals = array_length(mesh.normals);
+
+    return ok;
+}
+
+/**
+ * True when 'count' elements of 'size' bytes at 'offset' are inside a file of 'file_size' bytes
+ * (written so that a corrupt offset or count cannot wrap around)
+ */
+static bool block_fits(uint64_t offset, uint32_t count, size_t size, size_t file_size)
+{
+    return offset <= file_size && count <= (file_size - offset) / size;
+}
+
+bool load_mesh_file(char* filename)
+{
+    mapped_file_t file;
+
+    /* A missing binary mesh is not an error, callers fall back to the OBJ file; the mapping is kept as the mesh storage */
+    if (!map_file(filename, MAP_ACCESS_NORMAL, &file)) { return false; }
+
+    const mesh_file_header_t* header = (const mesh_file_header_t*)file.data;
+    bool valid = file.size >= sizeof(mesh_file_header_t) &&
+        header->magic == MESH_FILE_MAGIC &&
+        header->version == MESH_FILE_VERSION &&
+        header->header_size == sizeof(mesh_file_header_t) &&
+        header->face_size == sizeof(face_t) &&
+        header->vertex_offset % 16 == 0 &&
+        header->face_offset % 16 == 0 &&
+        header->normal_offset % 16 == 0 &&
+        header->face_normal_offset % 16 == 0 &&
+        block_fits(header->vertex_offset, header->num_vertices, sizeof(vec3_t), file.size) &&
+        block_fits(header->face_offset, header->num_faces, sizeof(face_t), file.size) &&
+        block_fits(header->normal_offset, header->num_normals, sizeof(vec3_t), file.size) &&
+        block_fits(header->face_normal_offset, header->num_faces, sizeof(vec3_t), file.size);
+
+    if (!valid) {
+        fprintf(stderr, "Invalid or outdated mesh file %s.\n", filename);
+        unmap_file(&file);
+        return false;
+    }
+
+    /* Every face index is validated once, so the renderer can trust the mapped data */
+    const face_t* faces = (const face_t*)(file.data + header->face_offset);
+
+    for (uint32_t i = 0; i < header->num_faces; i++) {
+        if ((uint32_t)faces[i].a >= header->num_vertices ||
+            (uint32_t)faces[i].b >= header->num_vertices ||
+            (uint32_t)faces[i].c >= header->num_vertices ||
+            (uint32_t)faces[i].a_normal >= header->num_normals ||
+            (uint32_t)faces[i].b_normal >= header->num_normals ||
+            (uint32_t)faces[i].c_normal >= header->num_normals) {
+            fprintf(stderr, "Mesh file %s has an out of range face index.\n", filename);
+            unmap_file(&file);
+            return false;
+        }
+    }
+
+    free_mesh();
+
+    mesh.mapping = file;
+    mesh.vertices = (vec3_t*)(file.data + header->vertex_offset);
+    mesh.faces = (face_t*)(file.data + header->face_offset);
+    mesh.normals = (vec3_t*)(file.data + header->normal_offset);
+    mesh.face_normals = (vec3_t*)(file.data + header->face_normal_offset);
+    mesh.num_vertices = (int)header->num_vertices;
+    mesh.num_faces = (int)header->num_faces;
+    mesh.num_normals = (int)header->num_normals;
+
+    return true;
+}
+
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + 15) & ~(uint64_t)15;
+}
+
+bool save_mesh_file(char* filename)
+{
+    FILE* file = fopen(filename, "wb");
+
+    if (!file) {
+        fprintf(stderr, "Error creating mesh file %s.\n", filename);
+        return false;
+    }
+
+    mesh_file_header_t header = {
+        .magic = MESH_FILE_MAGIC,
+        .version = MESH_FILE_VERSION,
+        .header_size = sizeof(mesh_file_header_t),
+        .face_size = sizeof(face_t),
+        .num_vertices = (uint32_t)mesh.num_vertices,
+        .num_faces = (uint32_t)mesh.num_faces,
+        .num_normals = (uint32_t)mesh.num_normals,
+        .reserved = 0,
+        .bounds_min = { 0, 0, 0 },
+        .bounds_max = { 0, 0, 0 }
+    };
+
+    header.vertex_offset = align_offset(sizeof(mesh_file_header_t));
+    header.face_offset = align_offset(header.vertex_offset + (uint64_t)mesh.num_vertices * sizeof(vec3_t));
+    header.normal_offset = align_offset(header.face_offset + (uint64_t)mesh.num_faces * sizeof(face_t));
+    header.face_normal_offset = align_offset(header.normal_offset + (uint64_t)mesh.num_normals * sizeof(vec3_t));
+
+    for (int i = 0; i < mesh.num_vertices; i++) {
+        vec3_t v = mesh.vertices[i];
+
+        if (i == 0 || v.x < header.bounds_min.x) { header.bounds_min.x = v.x; }
+        if (i == 0 || v.y < header.bounds_min.y) { header.bounds_min.y = v.y; }
+        if (i == 0 || v.z < header.bounds_min.z) { header.bounds_min.z = v.z; }
+        if (i == 0 || v.x > header.bounds_max.x) { header.bounds_max.x = v.x; }
+        if (i == 0 || v.y > header.bounds_max.y) { header.bounds_max.y = v.y; }
+        if (i == 0 || v.z > header.bounds_max.z) { header.bounds_max.z = v.z; }
+    }
+
+    static const unsigned char padding[16] = { 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    ok = ok && fwrite(padding, 1, header.vertex_offset - sizeof(header), file) == header.vertex_offset - sizeof(header);
+    ok = ok && fwrite(mesh.vertices, sizeof(vec3_t), mesh.num_vertices, file) == (size_t)mesh.num_vertices;
+
+    uint64_t vertex_end = header.vertex_offset + (uint64_t)mesh.num_vertices * sizeof(vec3_t);
+
+    ok = ok && fwrite(padding, 1, header.face_offset - vertex_end, file) == header.face_offset - vertex_end;
+    ok = ok && fwrite(mesh.faces, sizeof(face_t), mesh.num_faces, file) == (size_t)mesh.num_faces;
+
+    uint64_t face_end = header.face_offset + (uint64_t)mesh.num_faces * sizeof(face_t);
+
+    ok = ok && fwrite(padding, 1, header.normal_offset - face_end, file) == header.normal_offset - face_end;
+    ok = ok && fwrite(mesh.normals, sizeof(vec3_t), mesh.num_normals, file) == (size_t)mesh.num_normals;
+
+    uint64_t normal_end = header.normal_offset + (uint64_t)mesh.num_normals * sizeof(vec3_t);
+
+    ok = ok && fwrite(padding, 1, header.face_normal_offset - normal_end, file) == header.face_normal_offset - normal_end;
+    ok = ok && fwrite(mesh.face_normals, sizeof(vec3_t), mesh.num_faces, file) == (size_t)mesh.num_faces;
+
+    if (fclose(file) != 0) { ok = false; }
+
+    if (!ok) { fprintf(stderr, "Error writing mesh file %s.\n", filename); }
+
+    return ok;
+}
+
+void free_mesh(void)
+{
+    /* Mapped meshes point into the file, array-backed meshes own their memory */
+    if (mesh.mapping.data) {
+        unmap_file(&mesh.mapping);
+    } else {
+        array_free(mesh.vertices);
+        array_free(mesh.faces);
+        array_free(mesh.normals);
+        array_free(mesh.face_normals);
+    }
+
+    array_free(mesh.world_vertices);
+    array_free(mesh.clip_vertices);
+    array_free(mesh.world_normals);
+    array_free(mesh.world_face_normals);
+
+    mesh.vertices = NULL;
+    mesh.faces = NULL;
+    mesh.normals = NULL;
+    mesh.face_normals = NULL;
+    mesh.world_vertices = NULL;
+    mesh.clip_vertices = NULL;
+    mesh.world_normals = NULL;
+    mesh.world_face_normals = NULL;
+    mesh.num_vertices = 0;
+    mesh.num_faces = 0;
+    mesh.num_normals = 0;
+}
+
+/**
+ * True when the normal matrix maps unit vectors to unit vectors (rotation and uniform scale)
+ */
+static bool preserves_length(const mat4_t* normal_matrix)
+{
+    for (int i = 0; i < 3; i++) {
+        for (int j = i; j < 3; j++) {
+            float dot = (normal_matrix->m[0][i] * normal_matrix->m[0][j]) + (normal_matrix->m[1][i] * normal_matrix->m[1][j]) + (normal_matrix->m[2][i] * normal_matrix->m[2][j]);
+            float expected = (i == j) ? 1.0f : 0.0f;
+
+            if (fabsf(dot - expected) > 1e-4f) { return false; }
+        }
+    }
+
+    return true;
+}
+
+static void transform_normals(const mat4_t* normal_matrix, bool normalize, const vec3_t* normals, vec3_t* world_normals, int count)
+{
+    /* The normal matrix has no translation, normals are transformed as directions (w = 0) */
+    mat4_transform_dir3_array(normal_matrix, normals, world_normals, (size_t)count);
+
+    for (int i = 0; normalize && i < count; i++) {
+        world_normals[i] = unit_vector(world_normals[i]);
+    }
+}
+
+void transform_mesh_vertices(const mat4_t* world_matrix, const mat4_t* projection_matrix)
+{
+    int num_vertices = mesh.num_vertices;
+
+    /* The transformed buffers only need to be reallocated when the vertex count changes */
+    if ((int)array_length(mesh.world_vertices) != num_vertices) {
+        array_clear(mesh.world_vertices);
+        array_clear(mesh.clip_vertices);
+        mesh.world_vertices = array_hold(mesh.world_vertices, num_vertices, sizeof(vec4_t));
+        mesh.clip_vertices = array_hold(mesh.clip_vertices, num_vertices, sizeof(vec4_t));
+    }
+
+    if ((int)array_length(mesh.world_normals) != mesh.num_normals) {
+        array_clear(mesh.world_normals);
+        mesh.world_normals = array_hold(mesh.world_normals, mesh.num_normals, sizeof(vec3_t));
+    }
+
+    if ((int)array_length(mesh.world_face_normals) != mesh.num_faces) {
+        array_clear(mesh.world_face_normals);
+        mesh.world_face_normals = array_hold(mesh.world_face_normals, mesh.num_faces, sizeof(vec3_t));
+    }
+
+    /* Concatenate projection and world matrices once instead of once per vertex */
+    mat4_t world_projection_matrix;
+
+    mat4_multiply_mat4(projection_matrix, world_matrix, &world_projection_matrix);
+
+    mat4_transform_vec3_array(world_matrix, mesh.vertices, mesh.world_vertices, num_vertices);
+    mat4_transform_vec3_array(&world_projection_matrix, mesh.vertices, mesh.clip_vertices, num_vertices);
+
+    /* Load-time unit normals stay unit without a square root, unless the world matrix scales non-uniformly */
+    mat4_t normal_matrix = mat4_make_normal(world_matrix);
+    bool normalize = !preserves_length(&normal_matrix);
+
+    transform_normals(&normal_matrix, normalize, mesh.normals, mesh.world_normals, mesh.num_normals);
+    transform_normals(&normal_matrix, normalize, mesh.face_normals, mesh.world_face_normals, mesh.num_faces);
+}
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "array.h"
+#include "display.h"
+#include "vector.h"
+#include "mesh.h"
+#include "light.h"
+#include "texture.h"
+#include "clipping.h"
+#include "rasterizer.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "sort.h"
+#include "upng.h"
+
+vec3_t cameraPosition = {0, 0, 0};
+
+arena_t renderQueueArena;
+triangle_t* trianglesToRender = NULL;
+int numTrianglesToRender = 0;
+
+static bool reportedQueueFull = false;
+
+mat4_t worldMatrix;
+mat4_t projectMatrix;
+
+static float zNear = 0.1f;
+static float zFar = 100.0f;
+
+/**
+ * Front-to-back order of the queued triangles (dynamic arrays reused across frames)
+ */
+static uint16_t* sortKeys = NULL;
+static int* sortScratch = NULL;
+static int* renderOrder = NULL;
+
+bool loadMesh(char* meshFile)
+{
+    size_t length = strlen(meshFile);
+
+    /* Binary meshes are mapped as they are, anything else is parsed as an OBJ file */
+    if (length >= 5 && strcmp(meshFile + length - 5, ".mesh") == 0) {
+        return load_mesh_file(meshFile);
+    }
+
+    return load_obj_file_data(meshFile);
+}
+
+bool initializePipeline(int numThreads)
+{
+    /* Create the color buffer texture and the color/z-buffer memory (the color buffer is the texture itself when possible) */
+    if (!initializeColorBuffer()) {
+        return false;
+    }
+
+    /* Reserve the address space of the render queue (memory is only committed as it grows) */
+    if (!arena_init(&renderQueueArena, RENDER_QUEUE_RESERVE)) {
+        fprintf(stderr, "Error Reserving Render Queue Memory.\n");
+        return false;
+    }
+
+    if (!initializeRasterizer(numThreads)) {
+        return false;
+    }
+
+    /* Initialize the perspective projection matrix */
+    float fov = M_PI / 3.0;
+    float aspect = ((float)windowHeight / (float)windowWidth);
+    projectMatrix = mat4_make_perspective(fov, aspect, zNear, zFar);
+
+    return true;
+}
+
+/**
+ * Perspective divide and viewport mapping of a clipped vertex
+ */
+vec4_t project_to_screen(vec4_t clipVertex)
+{
+    vec4_t projected = clipVertex;
+
+    /* Perspective divide with the original z-value that is stored in w (w >= znear after clipping) */
+    projected.x /= clipVertex.w;
+    projected.y /= clipVertex.w;
+    projected.z /= clipVertex.w;
+
+    /**
+     * Flip vertically since the y values of the 3D mesh grow bottom->up and in screen space
+     * y values grow top->down
+     */
+    projected.y *= -1;
+
+    /* Scale into the view */
+    projected.x *= (windowWidth / 2.0);
+    projected.y *= (windowHeight / 2.0);
+
+    /* Translate the projected points to the middle of the screen */
+    projected.x += (windowWidth / 2.0);
+    projected.y += (windowHeight / 2.0);
+
+    return projected;
+}
+
+/**
+ * Sort stage: order the queued triangles front to back by the view depth (w) of their nearest vertex
+ * The depth is quantized to 16 bits over [zNear, zFar] and radix sorted; the sort is stable, so
+ * triangles in the same depth slice keep their face order and the image stays deterministic.
+ */
+static void sortFrame(void)
+{
+    array_clear(sortKeys);
+    array_clear(sortScratch);
+    array_clear(renderOrder);
+    sortKeys = array_hold(sortKeys, numTrianglesToRender, sizeof(uint16_t));
+    sortScratch = array_hold(sortScratch, numTrianglesToRender, sizeof(int));
+    renderOrder = array_hold(renderOrder, numTrianglesToRender, sizeof(int));
+
+    float scale = 65535.0f / (zFar - zNear);
+
+    for (int i = 0; i < numTrianglesToRender; i++) {
+        const vec4_t* points = trianglesToRender[i].points;
+        float nearest = points[0].w;
+
+        if (points[1].w < nearest) { nearest = points[1].w; }
+        if (points[2].w < nearest) { nearest = points[2].w; }
+
+        float key = (nearest - zNear) * scale;
+
+        sortKeys[i] = (uint16_t)(key < 0.0f ? 0.0f : (key > 65535.0f ? 65535.0f : key));
+    }
+
+    radix_sort_u16(sortKeys, renderOrder, sortScratch, numTrianglesToRender);
+}
+
+/**
+ * Transform stage: animate the mesh, transform its vertices, cull, clip and queue the triangles
+ */
+void transformFrame(void)
+{
+    arena_reset(&renderQueueArena);
+    trianglesToRender = (triangle_t*)renderQueueArena.base;
+    numTrianglesToRender = 0;
+
+    // Change the mesh scale/rotation values per animation frame
+    mesh.rotation.x += 0.01f;
+    mesh.rotation.y += 0.01f;
+    mesh.rotation.z += 0.01f;
+    mesh.translation.z = 5.0f;
+
+    // Create a scale, rotation and translation matrix that will be used to multiply the mesh vertices
+    mat4_t scaleMatrix = mat4_make_scale(mesh.scale.x, mesh.scale.y, mesh.scale.z);
+    mat4_t translationMatrix = mat4_make_translation(mesh.translation.x, mesh.translation.y, mesh.translation.z);
+    mat4_t rotationMatrixX = mat4_make_rotation_x(mesh.rotation.x);
+    mat4_t rotationMatrixY = mat4_make_rotation_y(mesh.rotation.y);
+    mat4_t rotationMatrixZ = mat4_make_rotation_z(mesh.rotation.z);
+
+    // Create a World Matrix combining scale, rotation, and translation matrices (once per frame)
+    worldMatrix = mat4_identity();
+
+    // Order matters : First scale, then rotate, the translate. 
+    // [T] * [R] * [S] * v
+    mat4_multiply_mat4(&scaleMatrix, &worldMatrix, &worldMatrix);
+    mat4_multiply_mat4(&rotationMatrixZ, &worldMatrix, &worldMatrix);
+    mat4_multiply_mat4(&rotationMatrixY, &worldMatrix, &worldMatrix);
+    mat4_multiply_mat4(&rotationMatrixX, &worldMatrix, &worldMatrix);
+    mat4_multiply_mat4(&translationMatrix, &worldMatrix, &worldMatrix);
+
+    // Transform every vertex of the mesh once, faces below only index into the results
+    PROFILE_SCOPE(PROFILE_VERTICES) {
+        transform_mesh_vertices(&worldMatrix, &projectMatrix);
+    }
+
+    PROFILE_BEGIN(PROFILE_FACES);
+
+    int num_faces = mesh.num_faces;
+    int numCulled = 0;
+    int numRejected = 0;
+    int numClipped = 0;
+    int numDropped = 0;
+
+    for (int i = 0; i < num_faces; i++) {
+        face_t meshFace = mesh.faces[i];
+
+        vec3_t vectorA = vec3_from_vec4(mesh.world_vertices[meshFace.a]);
+
+        /* Face normal computed at load time and transformed with the vertices */
+        vec3_t normal = mesh.world_face_normals[i];
+
+        /* Find the vector between vertex A in the triangle and the camera origin */
+        vec3_t cameraRay = vec3_sub(cameraPosition, vectorA);
+
+        /* Calculate how aligned the camera ray is with the face normal */
+        float dotNormalCamera = vec3_dot(normal, cameraRay);
+
+        /* Backface culling test to see if the current face should be projected */
+        if (CullMethod == CULL_BACKFACE) {
+            if (dotNormalCamera < 0) {
+                numCulled++;
+                continue;
+            }
+        }
+
+        /* Gouraud shading lights the vertices instead, and the rasterizer interpolates their intensities */
+        float shades[3] = { 0, 0, 0 };
+
+        if (ShadeMethod == SHADE_GOURAUD) {
+            shades[0] = -vec3_dot(mesh.world_normals[meshFace.a_normal], light.direction);
+            shades[1] = -vec3_dot(mesh.world_normals[meshFace.b_normal], light.direction);
+            shades[2] = -vec3_dot(mesh.world_normals[meshFace.c_normal], light.direction);
+        }
+
+        /* Clip the face against the frustum in clip space, before the perspective divide */
+        polygon_t polygon = polygon_from_triangle(
+            mesh.clip_vertices[meshFace.a], mesh.clip_vertices[meshFace.b], mesh.clip_vertices[meshFace.c],
+            meshFace.a_uv, meshFace.b_uv, meshFace.c_uv, shades
+        );
+
+        clip_result_t clipResult = clip_polygon(&polygon);
+
+        if (clipResult == CLIP_REJECTED) {
+            numRejected++;
+            continue;
+        }
+
+        if (clipResult == CLIP_CLIPPED) { numClipped++; }
+
+        float lightIntensityFactor = -vec3_dot(normal, light.direction);
+        uint32_t triangleColor = (ShadeMethod == SHADE_GOURAUD) ? meshFace.color : light_apply_intensity(meshFace.color, lightIntensityFactor);
+
+        /* Project the vertices of the clipped polygon once and render it as a triangle fan */
+        vec4_t projectedPoints[MAX_NUM_POLY_VERTICES];
+
+        for (int j = 0; j < polygon.num_vertices; j++) {
+            projectedPoints[j] = project_to_screen(polygon.vertices[j]);
+        }
+
+        for (int j = 1; j < polygon.num_vertices - 1; j++) {
+            triangle_t projectedTriangle = {
+                .points = { projectedPoints[0], projectedPoints[j], projectedPoints[j + 1] },
+                .texcoords = { polygon.texcoords[0], polygon.texcoords[j], polygon.texcoords[j + 1] },
+                .shades = { polygon.shades[0], polygon.shades[j], polygon.shades[j + 1] },
+                .color = triangleColor
+            };
+
+            /* Save the projected triangle in the array of triangles to render */
+            /* triangle_t only holds 4-byte fields, so a 4-byte alignment keeps the queue contiguous */
+            triangle_t* queuedTriangle = (triangle_t*)arena_push(&renderQueueArena, sizeof(triangle_t), sizeof(float));
+
+            if (queuedTriangle) {
+                *queuedTriangle = projectedTriangle;
+                numTrianglesToRender++;
+            } else {
+                numDropped++;
+            }
+        }
+    }
+
+    PROFILE_END(PROFILE_FACES);
+
+    /* Only a full reserve (or a failed commit) drops triangles: reported once, and counted every frame */
+    if (numDropped > 0 && !reportedQueueFull) {
+        fprintf(stderr, "Render queue is full (%zu bytes reserved), %d triangles dropped.\n", renderQueueArena.reserved, numDropped);
+        reportedQueueFull = true;
+    }
+
+    if (SortMethod == SORT_FRONT_TO_BACK) {
+        PROFILE_SCOPE(PROFILE_SORT) {
+            sortFrame();
+        }
+    }
+
+    PROFILE_COUNTER(COUNTER_FACES_SUBMITTED, num_faces);
+    PROFILE_COUNTER(COUNTER_FACES_CULLED, numCulled);
+    PROFILE_COUNTER(COUNTER_FACES_REJECTED, numRejected);
+    PROFILE_COUNTER(COUNTER_FACES_CLIPPED, numClipped);
+    PROFILE_COUNTER(COUNTER_TRIANGLES, numTrianglesToRender);
+    PROFILE_COUNTER(COUNTER_TRIANGLES_DROPPED, numDropped);
+    PROFILE_COUNTER(COUNTER_QUEUE_BYTES, (int)renderQueueArena.used);
+}
+
+/**
+ * Raster stage: draw the queued triangles and the overlays into the color buffer
+ */
+void rasterizeFrame(void)
+{
+    bool wireframe = (RenderMethod == RENDER_WIRE || RenderMethod == RENDER_WIRE_VERTEX || RenderMethod == RENDER_FILL_TRIANGLE_WIRE || RenderMethod == RENDER_TEXTURED_WIRE);
+    bool hud = (profilerEnabled && profilerHudVisible);
+
+    /* Lock the texture for direct presentation; the color buffer itself stays in system memory */
+    bool locked = directPresent && lockColorBuffer();
+
+    PROFILE_SCOPE(PROFILE_RASTER) {
+        /* Clear the tiles and rasterize the filled or textured triangles tile by tile on the worker threads,
+           which also write the tiles that changed into the texture unless wireframes are drawn over all of them */
+        const int* order = (SortMethod == SORT_FRONT_TO_BACK) ? renderOrder : NULL;
+
+        rasterizeTriangles(trianglesToRender, numTrianglesToRender, order, &mesh_texture, locked && !wireframe);
+    }
+
+    PROFILE_BEGIN(PROFILE_OVERLAY);
+
+    /* Loop all projected triangles and draw the wireframe and vertex overlays on top */
+    for (int i = 0; i < numTrianglesToRender; i++) {
+        triangle_t triangle = trianglesToRender[i];
+
+        /* Draw Triangle Wireframe */
+        if (wireframe) {
+            drawTriangle(
+                (Point){ triangle.points[0].x, triangle.points[0].y },
+                (Point){ triangle.points[1].x, triangle.points[1].y },
+                (Point){ triangle.points[2].x, triangle.points[2].y },
+                0xFFFFFFFF);
+        }
+
+        /* Draw Triangle Vertex Points */
+        if (RenderMethod == RENDER_WIRE_VERTEX) {
+            drawRect((Point){ triangle.points[0].x - 3, triangle.points[0].y - 3 }, 6, 6, 0xFFFF0000);
+            drawRect((Point){ triangle.points[1].x - 3, triangle.points[1].y - 3 }, 6, 6, 0xFFFF0000);
+            drawRect((Point){ triangle.points[2].x - 3, triangle.points[2].y - 3 }, 6, 6, 0xFFFF0000);
+        }
+    }
+    
+    /* Overlays are drawn outside of the tile rasterizer, so every tile needs its background back */
+    if (wireframe) {
+        invalidateTiles();
+    }
+
+    PROFILE_END(PROFILE_OVERLAY);
+
+    /* The HUD is drawn outside of the tile rasterizer too, but only covers a few tiles */
+    if (hud) {
+        drawProfilerHud(PROFILE_HUD_X, PROFILE_HUD_Y);
+        invalidateTileRect(PROFILE_HUD_X, PROFILE_HUD_Y, PROFILE_HUD_X + PROFILE_HUD_WIDTH - 1, PROFILE_HUD_Y + PROFILE_HUD_HEIGHT - 1);
+    }
+
+    /* Wireframes touch (and invalidate) every tile, so the whole frame is written into the texture after them;
+       otherwise only the HUD still has to be written over its tiles */
+    if (locked && wireframe) {
+        presentColorBufferRect(0, 0, windowWidth - 1, windowHeight - 1);
+    } else if (locked && hud) {
+        presentColorBufferRect(PROFILE_HUD_X, PROFILE_HUD_Y, PROFILE_HUD_X + PROFILE_HUD_WIDTH - 1, PROFILE_HUD_Y + PROFILE_HUD_HEIGHT - 1);
+    }
+}
+
+/**
+ * Present stage: hand the color buffer to the SDL renderer
+ */
+void presentFrame(void)
+{
+    PROFILE_BEGIN(PROFILE_PRESENT);
+
+    SDL_RenderClear(renderer);
+
+    renderColorBuffer();
+
+    SDL_RenderPresent(renderer);
+
+    PROFILE_END(PROFILE_PRESENT);
+}
+
+void destroyPipeline(void)
+{
+    destroyRasterizer();
+    arena_release(&renderQueueArena);
+    destroyColorBuffer();
+    free_mesh();
+
+    array_free(sortKeys);
+    array_free(sortScratch);
+    array_free(renderOrder);
+    sortKeys = NULL;
+    sortScratch = NULL;
+    renderOrder = NULL;
+
+    free_png_texture();
+}
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "display.h"
+#include "profiler.h"
+
+bool profilerEnabled = false;
+bool profilerHudVisible = false;
+
+/**
+ * Ring buffer of frames: 'frames[numFrames % PROFILE_HISTORY]' is the frame being recorded
+ */
+static profile_frame_t frames[PROFILE_HISTORY];
+static uint64_t numFrames = 0;
+static uint64_t startTicks = 0;
+static uint64_t stageBegin[NUM_PROFILE_STAGES];
+static bool frameOpen = false;     // beginProfileFrame() ran with the profiler enabled
+
+static const char* stageNames[NUM_PROFILE_STAGES] = {
+    "input", "vertices", "faces", "sort", "raster", "overlay", "present"
+};
+
+static const char* counterNames[NUM_PROFILE_COUNTERS] = {
+    "faces submitted", "faces culled", "faces rejected", "faces clipped", "triangles",
+    "triangles dropped", "queue bytes",
+    "tiles rasterized", "tiles cleared", "pixels tested", "depth failed", "texels fetched"
+};
+
+static const uint32_t stageColors[NUM_PROFILE_STAGES] = {
+    0xFF808080, 0xFF4080FF, 0xFF40C0FF, 0xFFC040FF, 0xFFFF8040, 0xFFFFFF40, 0xFF40FF40
+};
+
+static uint64_t now(void) {
+    return SDL_GetPerformanceCounter() - startTicks;
+}
+
+static profile_frame_t* currentFrame(void) {
+    return &frames[numFrames % PROFILE_HISTORY];
+}
+
+void initializeProfiler(bool enabled) {
+    memset(frames, 0, sizeof(frames));
+    memset(stageBegin, 0, sizeof(stageBegin));
+    numFrames = 0;
+    frameOpen = false;
+    startTicks = SDL_GetPerformanceCounter();
+    profilerEnabled = enabled;
+}
+
+void beginProfileFrame(void) {
+    if (!profilerEnabled) { return; }
+
+    profile_frame_t* frame = currentFrame();
+
+    memset(frame, 0, sizeof(*frame));
+    memset(stageBegin, 0, sizeof(stageBegin));
+    frame->start = now();
+    frameOpen = true;
+}
+
+void endProfileFrame(void) {
+    /* Frames the profiler was enabled or disabled in the middle of are not recorded */
+    if (!profilerEnabled || !frameOpen) {
+        frameOpen = false;
+        return;
+    }
+
+    profile_frame_t* frame = currentFrame();
+
+    frame->duration = now() - frame->start;
+    frameOpen = false;
+    numFrames++;
+}
+
+void beginProfileStage(profile_stage_t stage) {
+    stageBegin[stage] = now();
+
+    /* A stage entered several times in a frame spans from its first begin, its duration adds up */
+    if (currentFrame()->stageDuration[stage] == 0) {
+        currentFrame()->stageStart[stage] = stageBegin[stage];
+    }
+}
+
+void endProfileStage(profile_stage_t stage) {
+    /* The profiler may have been enabled inside the stage */
+    if (stageBegin[stage] == 0) { return; }
+
+    currentFrame()->stageDuration[stage] += now() - stageBegin[stage];
+    stageBegin[stage] = 0;
+}
+
+void setProfileCounter(profile_counter_t counter, int value) {
+    currentFrame()->counters[counter] = value;
+}
+
+const profile_frame_t* lastProfileFrame(void) {
+    return (numFrames > 0) ? &frames[(numFrames - 1) % PROFILE_HISTORY] : NULL;
+}
+
+const char* profileCounterName(profile_counter_t counter) {
+    return counterNames[counter];
+}
+
+/**
+ * HUD glyphs (digits only: the stages are told apart by color)
+ */
+#define HUD_GLYPH_SCALE     2
+#define HUD_GLYPH_WIDTH     (4 * HUD_GLYPH_SCALE)
+#define HUD_ROW_HEIGHT      (7 * HUD_GLYPH_SCALE)
+
+/* 3x5 glyphs of '0'-'9' and '.', one row per 3 bits (most significant bit on the left) */
+static const uint8_t digitGlyphs[11][5] = {
+    { 7, 5, 5, 5, 7 }, { 2, 6, 2, 2, 7 }, { 7, 1, 7, 4, 7 }, { 7, 1, 7, 1, 7 }, { 5, 5, 7, 1, 1 },
+    { 7, 4, 7, 1, 7 }, { 7, 4, 7, 5, 7 }, { 7, 1, 1, 1, 1 }, { 7, 5, 7, 5, 7 }, { 7, 5, 7, 1, 7 },
+    { 0, 0, 0, 0, 2 }
+};
+
+static void drawNumber(int x, int y, const char* text, uint32_t color) {
+    for (; *text; text++, x += HUD_GLYPH_WIDTH) {
+        int glyph = (*text == '.') ? 10 : (*text - '0');
+
+        if (glyph < 0 || glyph > 10) { continue; }
+
+        for (int row = 0; row < 5; row++) {
+            for (int column = 0; column < 3; column++) {
+                if (digitGlyphs[glyph][row] & (4 >> column)) {
+                    drawRect((Point){ x + (column * HUD_GLYPH_SCALE), y + (row * HUD_GLYPH_SCALE) }, HUD_GLYPH_SCALE, HUD_GLYPH_SCALE, color);
+                }
+            }
+        }
+    }
+}
+
+void drawProfilerHud(int x, int y) {
+    int maxX = x + PROFILE_HUD_WIDTH - 1;
+    int maxY = y + PROFILE_HUD_HEIGHT - 1;
+
+    if (maxX > windowWidth - 1) { maxX = windowWidth - 1; }
+    if (maxY > windowHeight - 1) { maxY = windowHeight - 1; }
+    if (x < 0 || y < 0 || maxX < x || maxY < y) { return; }
+
+    clearColorBufferRect(x, y, maxX, maxY, 0xFF101010, false);
+
+    int numRecorded = (numFrames < PROFILE_HISTORY) ? (int)numFrames : PROFILE_HISTORY;
+    double ticksToMs = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    double means[NUM_PROFILE_STAGES + 1] = { 0.0 };
+    int graphBottom = y + PROFILE_HUD_GRAPH_HEIGHT - 1;
+
+    /* Columns from the oldest recorded frame to the newest */
+    for (int i = 0; i < numRecorded; i++) {
+        const profile_frame_t* frame = &frames[(numFrames - numRecorded + i) % PROFILE_HISTORY];
+        int column = x + (PROFILE_HISTORY - numRecorded) + i;
+        double top = graphBottom;
+
+        for (int stage = 0; stage < NUM_PROFILE_STAGES; stage++) {
+            double ms = frame->stageDuration[stage] * ticksToMs;
+            double bottom = top;
+
+            means[stage] += ms / numRecorded;
+            top -= ms * (PROFILE_HUD_GRAPH_HEIGHT / PROFILE_HUD_GRAPH_MS);
+
+            for (int row = (int)bottom; row > (int)top && row > y; row--) {
+                drawPixel((Point){ column, row }, stageColors[stage]);
+            }
+        }
+
+        means[NUM_PROFILE_STAGES] += (frame->duration * ticksToMs) / numRecorded;
+    }
+
+    /* Frame budget line (FRAME_TARGET_TIME) */
+    int budgetY = graphBottom - (int)(FRAME_TARGET_TIME * (PROFILE_HUD_GRAPH_HEIGHT / PROFILE_HUD_GRAPH_MS));
+
+    for (int column = x; column < x + PROFILE_HISTORY; column += 2) {
+        drawPixel((Point){ column, budgetY }, 0xFFFFFFFF);
+    }
+
+    /* Mean time of every stage next to its color, then of the whole frame */
+    char text[32];
+    int rowY = y + PROFILE_HUD_GRAPH_HEIGHT + 4;
+
+    for (int stage = 0; stage <= NUM_PROFILE_STAGES; stage++) {
+        int keyX = x + ((stage % 4) * (PROFILE_HUD_WIDTH / 4));
+        int keyY = rowY + ((stage / 4) * HUD_ROW_HEIGHT);
+        uint32_t color = (stage < NUM_PROFILE_STAGES) ? stageColors[stage] : 0xFFFFFFFF;
+
+        snprintf(text, sizeof(text), "%.2f", means[stage]);
+        drawRect((Point){ keyX + 2, keyY }, 3 * HUD_GLYPH_SCALE, 5 * HUD_GLYPH_SCALE, color);
+        drawNumber(keyX + 2 + HUD_GLYPH_WIDTH, keyY, text, color);
+    }
+}
+
+bool writeProfilerTrace(const char* filename) {
+    FILE* file = fopen(filename, "w");
+
+    if (!file) {
+        fprintf(stderr, "Error creating trace file %s.\n", filename);
+        return false;
+    }
+
+    int numRecorded = (numFrames < PROFILE_HISTORY) ? (int)numFrames : PROFILE_HISTORY;
+    double ticksToUs = 1000000.0 / (double)SDL_GetPerformanceFrequency();
+
+    /* Chrome trace_event format: complete ("X") events for frames and stages, counter ("C") events */
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}}");
+
+    for (int i = 0; i < numRecorded; i++) {
+        const profile_frame_t* frame = &frames[(numFrames - numRecorded + i) % PROFILE_HISTORY];
+
+        fprintf(file, ",\n{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+            frame->start * ticksToUs, frame->duration * ticksToUs);
+
+        for (int stage = 0; stage < NUM_PROFILE_STAGES; stage++) {
+            if (frame->stageDuration[stage] == 0) { continue; }
+
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+                stageNames[stage], frame->stageStart[stage] * ticksToUs, frame->stageDuration[stage] * ticksToUs);
+        }
+
+        fprintf(file, ",\n{\"name\":\"counters\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{", frame->start * ticksToUs);
+
+        for (int counter = 0; counter < NUM_PROFILE_COUNTERS; counter++) {
+            fprintf(file, "%s\"%s\":%d", (counter > 0) ? "," : "", counterNames[counter], frame->counters[counter]);
+        }
+
+        fprintf(file, "}}");
+    }
+
+    fprintf(file, "\n]}\n");
+
+    bool ok = (ferror(file) == 0);
+
+    fclose(file);
+
+    return ok;
+}
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "display.h"
+#include "profiler.h"
+#include "rasterizer.h"
+
+#define MAX_RASTER_THREADS      64
+
+/**
+ * Per-tile dynamic array of indices into the triangle array of the current frame
+ * Bins are cleared (not freed) every frame, so they stop allocating once they reach their peak size
+ */
+typedef struct {
+    int* triangles;
+} tile_bin_t;
+
+static tile_bin_t* tileBins = NULL;
+
+/**
+ * Lazy clears
+ * A tile is dirty when its color memory may differ from the background. Tiles with triangles are
+ * cleared (color and depth) right before they are rasterized, while their memory is about to be
+ * used; dirty tiles without triangles only get their color background back, with streaming stores.
+ * Depth is never cleared for tiles that nothing touches, since nothing reads it.
+ */
+static bool* tileDirty = NULL;
+static int tilesX = 0;
+static int tilesY = 0;
+static int numTiles = 0;
+
+/**
+ * Worker pool state
+ * The main thread posts 'frameStart' once per worker, every thread (main included) claims
+ * tiles through 'nextTile' until none are left, then each worker posts 'frameDone'.
+ */
+static SDL_Thread* workers[MAX_RASTER_THREADS];
+static int workerIndices[MAX_RASTER_THREADS];
+static int numWorkers = 0;
+static SDL_sem* frameStart = NULL;
+static SDL_sem* frameDone = NULL;
+static SDL_atomic_t nextTile;
+static SDL_atomic_t shuttingDown;
+
+/**
+ * Inputs of the frame being rasterized (written before the workers are released)
+ */
+static triangle_t* frameTriangles = NULL;
+static const texture_t* frameTexture = NULL;
+static bool frameCountStats = false;
+static bool framePresentTiles = false;
+
+/**
+ * Pixel statistics of every thread (workers first, the main thread last), padded to their own cache line
+ */
+typedef struct {
+    raster_stats_t stats;
+    char padding[64 - sizeof(raster_stats_t)];
+} thread_stats_t;
+
+static thread_stats_t threadStats[MAX_RASTER_THREADS];
+
+static int clampInt(float value, int min, int max) {
+    if (value < min) { return min; }
+    if (value > max) { return max; }
+    return (int)value;
+}
+
+static void binTriangle(const triangle_t* triangle, int triangleIndex) {
+    float minX = triangle->points[0].x;
+    float minY = triangle->points[0].y;
+    float maxX = minX;
+    float maxY = minY;
+
+    for (int i = 1; i < 3; i++) {
+        if (triangle->points[i].x < minX) { minX = triangle->points[i].x; }
+        if (triangle->points[i].y < minY) { minY = triangle->points[i].y; }
+        if (triangle->points[i].x > maxX) { maxX = triangle->points[i].x; }
+        if (triangle->points[i].y > maxY) { maxY = triangle->points[i].y; }
+    }
+
+    /* Reject triangles that are completely outside of the screen */
+    if (maxX < 0 || maxY < 0 || minX >= windowWidth || minY >= windowHeight) { return; }
+
+    int tileMinX = clampInt(minX, 0, windowWidth - 1) / TILE_SIZE;
+    int tileMinY = clampInt(minY, 0, windowHeight - 1) / TILE_SIZE;
+    int tileMaxX = clampInt(maxX, 0, windowWidth - 1) / TILE_SIZE;
+    int tileMaxY = clampInt(maxY, 0, windowHeight - 1) / TILE_SIZE;
+
+    for (int ty = tileMinY; ty <= tileMaxY; ty++) {
+        for (int tx = tileMinX; tx <= tileMaxX; tx++) {
+            array_push(tileBins[(ty * tilesX) + tx].triangles, triangleIndex);
+        }
+    }
+}
+
+static ClipRect tileClipRect(int tileIndex) {
+    int tx = tileIndex % tilesX;
+    int ty = tileIndex / tilesX;
+
+    ClipRect clip = {
+        .minX = tx * TILE_SIZE,
+        .minY = ty * TILE_SIZE,
+        .maxX = (tx + 1) * TILE_SIZE - 1,
+        .maxY = (ty + 1) * TILE_SIZE - 1
+    };
+
+    if (clip.maxX > windowWidth - 1) { clip.maxX = windowWidth - 1; }
+    if (clip.maxY > windowHeight - 1) { clip.maxY = windowHeight - 1; }
+
+    return clip;
+}
+
+static void clearTileBackground(ClipRect clip, bool streaming) {
+    clearColorBufferRect(clip.minX, clip.minY, clip.maxX, clip.maxY, CLEAR_COLOR, streaming);
+    drawGridRect(clip.minX, clip.minY, clip.maxX, clip.maxY, GRID_COLOR);
+}
+
+static void rasterizeTile(int tileIndex, raster_stats_t* stats) {
+    tile_bin_t* bin = &tileBins[tileIndex];
+    int numBinTriangles = (int)array_length(bin->triangles);
+    ClipRect clip = tileClipRect(tileIndex);
+
+    /* Nothing touches this tile: restore its background only if the last frame drew into it */
+    if (numBinTriangles == 0) {
+        if (tileDirty[tileIndex]) {
+            /* Streaming stores would evict the tile right before it is read back for presentation */
+            clearTileBackground(clip, !framePresentTiles);
+            tileDirty[tileIndex] = false;
+
+            if (framePresentTiles) {
+                presentColorBufferRect(clip.minX, clip.minY, clip.maxX, clip.maxY);
+            }
+        }
+        return;
+    }
+
+    bool textured = (RenderMethod == RENDER_TEXTURED || RenderMethod == RENDER_TEXTURED_WIRE);
+    bool shaded = (ShadeMethod == SHADE_GOURAUD);
+    bool overdraw = (RenderMethod == RENDER_OVERDRAW);
+
+    /* First touch of the tile this frame: clear it while it is about to be used (to zero write counts for the heatmap) */
+    if (overdraw) {
+        clearColorBufferRect(clip.minX, clip.minY, clip.maxX, clip.maxY, 0, false);
+    } else {
+        clearTileBackground(clip, false);
+    }
+
+    clearZBufferRect(clip.minX, clip.minY, clip.maxX, clip.maxY);
+    tileDirty[tileIndex] = true;
+
+    for (int i = 0; i < numBinTriangles; i++) {
+        triangle_t* triangle = &frameTriangles[bin->triangles[i]];
+
+        if (overdraw) {
+            drawOverdrawTriangleClipped(
+                (Point4){ triangle->points[0].x, triangle->points[0].y, triangle->points[0].z, triangle->points[0].w },
+                (Point4){ triangle->points[1].x, triangle->points[1].y, triangle->points[1].z, triangle->points[1].w },
+                (Point4){ triangle->points[2].x, triangle->points[2].y, triangle->points[2].z, triangle->points[2].w },
+                clip, stats
+            );
+        } else if (textured) {
+            drawTexturedTriangleClipped(
+                (TexturePoint){ triangle->points[0].x, triangle->points[0].y, triangle->points[0].z, triangle->points[0].w, triangle->texcoords[0].u, triangle->texcoords[0].v },
+                (TexturePoint){ triangle->points[1].x, triangle->points[1].y, triangle->points[1].z, triangle->points[1].w, triangle->texcoords[1].u, triangle->texcoords[1].v },
+                (TexturePoint){ triangle->points[2].x, triangle->points[2].y, triangle->points[2].z, triangle->points[2].w, triangle->texcoords[2].u, triangle->texcoords[2].v },
+                frameTexture, clip, stats
+            );
+        } else if (shaded) {
+            drawShadedTriangleClipped(
+                (Point4){ triangle->points[0].x, triangle->points[0].y, triangle->points[0].z, triangle->points[0].w },
+                (Point4){ triangle->points[1].x, triangle->points[1].y, triangle->points[1].z, triangle->points[1].w },
+                (Point4){ triangle->points[2].x, triangle->points[2].y, triangle->points[2].z, triangle->points[2].w },
+                triangle->color, triangle->shades, clip, stats
+            );
+        } else {
+            drawFilledTriangleClipped(
+                (Point4){ triangle->points[0].x, triangle->points[0].y, triangle->points[0].z, triangle->points[0].w },
+                (Point4){ triangle->points[1].x, triangle->points[1].y, triangle->points[1].z, triangle->points[1].w },
+                (Point4){ triangle->points[2].x, triangle->points[2].y, triangle->points[2].z, triangle->points[2].w },
+                triangle->color, clip, stats
+            );
+        }
+    }
+
+    if (overdraw) {
+        resolveOverdrawRect(clip.minX, clip.minY, clip.maxX, clip.maxY);
+    }
+
+    /* The tile is finished: write it into the locked texture while it is still in the cache */
+    if (framePresentTiles) {
+        presentColorBufferRect(clip.minX, clip.minY, clip.maxX, clip.maxY);
+    }
+}
+
+static void rasterizeClaimedTiles(int threadIndex) {
+    raster_stats_t* stats = frameCountStats ? &threadStats[threadIndex].stats : NULL;
+
+    while (true) {
+        int tileIndex = SDL_AtomicAdd(&nextTile, 1);
+
+        if (tileIndex >= numTiles) { break; }
+
+        rasterizeTile(tileIndex, stats);
+    }
+}
+
+static int rasterWorker(void* data) {
+    int threadIndex = *(int*)data;
+
+    while (true) {
+        SDL_SemWait(frameStart);
+
+        if (SDL_AtomicGet(&shuttingDown)) { break; }
+
+        rasterizeClaimedTiles(threadIndex);
+
+        SDL_SemPost(frameDone);
+    }
+
+    return 0;
+}
+
+bool initializeRasterizer(int numThreads) {
+    tilesX = (windowWidth + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (windowHeight + TILE_SIZE - 1) / TILE_SIZE;
+    numTiles = tilesX * tilesY;
+
+    tileBins = (tile_bin_t*)calloc(numTiles, sizeof(tile_bin_t));
+    tileDirty = (bool*)malloc(sizeof(bool) * numTiles);
+
+    if (!tileBins || !tileDirty) {
+        fprintf(stderr, "Allocating Tile Bins Failed.\n");
+        return false;
+    }
+
+    frameStart = SDL_CreateSemaphore(0);
+    frameDone = SDL_CreateSemaphore(0);
+
+    if (!frameStart || !frameDone) {
+        fprintf(stderr, "Error Creating Rasterizer Semaphores.\n");
+        return false;
+    }
+
+    /* The color buffer starts uninitialized, so every tile needs its background */
+    invalidateTiles();
+
+    SDL_AtomicSet(&shuttingDown, 0);
+
+    /* The main thread rasterizes too, so it counts as one of the threads */
+    if (numThreads > MAX_RASTER_THREADS) { numThreads = MAX_RASTER_THREADS; }
+
+    for (numWorkers = 0; numWorkers < numThreads - 1; numWorkers++) {
+        workerIndices[numWorkers] = numWorkers;
+        workers[numWorkers] = SDL_CreateThread(rasterWorker, "RasterWorker", &workerIndices[numWorkers]);
+
+        if (!workers[numWorkers]) {
+            fprintf(stderr, "Error Creating Raster Worker Thread.\n");
+            break;
+        }
+    }
+
+    return true;
+}
+
+void invalidateTiles(void) {
+    for (int i = 0; i < numTiles; i++) {
+        tileDirty[i] = true;
+    }
+}
+
+void invalidateTileRect(int minX, int minY, int maxX, int maxY) {
+    if (maxX < 0 || maxY < 0 || minX >= windowWidth || minY >= windowHeight) { return; }
+
+    int tileMinX = (minX < 0 ? 0 : minX) / TILE_SIZE;
+    int tileMinY = (minY < 0 ? 0 : minY) / TILE_SIZE;
+    int tileMaxX = (maxX > windowWidth - 1 ? windowWidth - 1 : maxX) / TILE_SIZE;
+    int tileMaxY = (maxY > windowHeight - 1 ? windowHeight - 1 : maxY) / TILE_SIZE;
+
+    for (int ty = tileMinY; ty <= tileMaxY; ty++) {
+        for (int tx = tileMinX; tx <= tileMaxX; tx++) {
+            tileDirty[(ty * tilesX) + tx] = true;
+        }
+    }
+}
+
+void rasterizeTriangles(triangle_t* triangles, int numTriangles, const int* order, const texture_t* texture, bool presentTiles) {
+    bool filled = (RenderMethod == RENDER_FILL_TRIANGLE || RenderMethod == RENDER_FILL_TRIANGLE_WIRE ||
+                   RenderMethod == RENDER_TEXTURED || RenderMethod == RENDER_TEXTURED_WIRE ||
+                   RenderMethod == RENDER_OVERDRAW);
+
+    /* Binning stage: sort the triangles into every tile their bounding box overlaps */
+    for (int i = 0; i < numTiles; i++) {
+        array_clear(tileBins[i].triangles);
+    }
+
+    for (int i = 0; filled && i < numTriangles; i++) {
+        int triangleIndex = order ? order[i] : i;
+
+        binTriangle(&triangles[triangleIndex], triangleIndex);
+    }
+
+    if (profilerEnabled) {
+        int tilesRasterized = 0;
+        int tilesCleared = 0;
+
+        for (int i = 0; i < numTiles; i++) {
+            if (array_length(tileBins[i].triangles) > 0) {
+                tilesRasterized++;
+            } else if (tileDirty[i]) {
+                tilesCleared++;
+            }
+        }
+
+        PROFILE_COUNTER(COUNTER_TILES_RASTERIZED, tilesRasterized);
+        PROFILE_COUNTER(COUNTER_TILES_CLEARED, tilesCleared);
+    }
+
+    /* Rasterization stage: release the workers and help them until every tile is done */
+    frameTriangles = triangles;
+    frameTexture = texture;
+    frameCountStats = profilerEnabled;
+    framePresentTiles = presentTiles;
+    SDL_AtomicSet(&nextTile, 0);
+
+    if (frameCountStats) {
+        memset(threadStats, 0, sizeof(threadStats));
+    }
+
+    for (int i = 0; i < numWorkers; i++) {
+        SDL_SemPost(frameStart);
+    }
+
+    rasterizeClaimedTiles(numWorkers);
+
+    for (int i = 0; i < numWorkers; i++) {
+        SDL_SemWait(frameDone);
+    }
+
+    /* Every thread is done: add up the pixel statistics */
+    if (frameCountStats) {
+        raster_stats_t total = { 0 };
+
+        for (int i = 0; i <= numWorkers; i++) {
+            total.pixelsTested += threadStats[i].stats.pixelsTested;
+            total.depthFailed += threadStats[i].stats.depthFailed;
+            total.texelsFetched += threadStats[i].stats.texelsFetched;
+        }
+
+        PROFILE_COUNTER(COUNTER_PIXELS_TESTED, total.pixelsTested);
+        PROFILE_COUNTER(COUNTER_DEPTH_FAILED, total.depthFailed);
+        PROFILE_COUNTER(COUNTER_TEXELS_FETCHED, total.texelsFetched);
+    }
+}
+
+void destroyRasterizer(void) {
+    SDL_AtomicSet(&shuttingDown, 1);
+
+    for (int i = 0; i < numWorkers; i++) {
+        SDL_SemPost(frameStart);
+    }
+
+    for (int i = 0; i < numWorkers; i++) {
+        SDL_WaitThread(workers[i], NULL);
+    }
+
+    numWorkers = 0;
+
+    if (frameStart) { SDL_DestroySemaphore(frameStart); }
+    if (frameDone) { SDL_DestroySemaphore(frameDone); }
+
+    for (int i = 0; i < numTiles; i++) {
+        array_free(tileBins[i].triangles);
+    }
+
+    free(tileBins);
+    free(tileDirty);
+    tileBins = NULL;
+    tileDirty = NULL;
+}
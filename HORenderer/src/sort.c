@@ -0,0 +1,43 @@
+#include <string.h>
+
+#include "sort.h"
+
+void radix_sort_u16(const uint16_t* keys, int* order, int* scratch, int count)
+{
+    int low_offsets[256];
+    int high_offsets[256];
+
+    memset(low_offsets, 0, sizeof(low_offsets));
+    memset(high_offsets, 0, sizeof(high_offsets));
+
+    /* Both histograms in a single pass over the keys */
+    for (int i = 0; i < count; i++) {
+        low_offsets[keys[i] & 0xFF]++;
+        high_offsets[keys[i] >> 8]++;
+    }
+
+    /* Histograms -> exclusive prefix sums (first output slot of every bucket) */
+    int low_sum = 0;
+    int high_sum = 0;
+
+    for (int bucket = 0; bucket < 256; bucket++) {
+        int low_count = low_offsets[bucket];
+        int high_count = high_offsets[bucket];
+
+        low_offsets[bucket] = low_sum;
+        high_offsets[bucket] = high_sum;
+        low_sum += low_count;
+        high_sum += high_count;
+    }
+
+    /* Low byte pass scatters the identity order into 'scratch', the high byte pass back into 'order' */
+    for (int i = 0; i < count; i++) {
+        scratch[low_offsets[keys[i] & 0xFF]++] = i;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int index = scratch[i];
+
+        order[high_offsets[keys[index] >> 8]++] = index;
+    }
+}
@@ -1,26 +1,519 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "display.h"
 #include "texture.h"
+#include "mapped_file.h"
+#include "upng.h"
 
-int texture_width = 64;
-int texture_height = 64;
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#define make_directory(path) _mkdir(path)
+#else
+#define make_directory(path) mkdir(path, 0755)
+#endif
 
-upng_t* png_texture = NULL;
-uint32_t* mesh_texture = NULL;
+/* Decoded textures are cached next to the build unless the build says otherwise */
+#ifndef TEXTURE_CACHE_DIR
+#define TEXTURE_CACHE_DIR   "texture_cache/"
+#endif
 
-void load_png_texture_data(char* filename)
+/**
+ * Texture cache file (written after the first decode of a PNG file, one per source path)
+ * | header | texel block (uint32_t[] of every level, one after the other) |
+ * The texels are stored as the renderer uses them (COLOR_BUFFER_FORMAT, mip chain, swizzled levels),
+ * so a valid cache file is mapped and the levels point into it without decoding or copying.
+ * The key is a hash of the source path, modification time and size: a changed PNG file
+ * no longer matches and is decoded again.
+ */
+#define TEXTURE_CACHE_MAGIC     0x58455448      // "HTEX"
+#define TEXTURE_CACHE_VERSION   1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t texel_format;      // COLOR_BUFFER_FORMAT of the writer, must match the reader
+    uint64_t key;
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_levels;
+    uint32_t reserved;
+    uint64_t texel_offset;      // byte offset of the texel block from the start of the file (64-byte aligned)
+} texture_cache_header_t;
+
+texture_t mesh_texture = { .num_levels = 0 };
+
+/* Texels of all the levels of mesh_texture, one after the other (decoded textures) */
+static uint32_t* texel_memory = NULL;
+
+/* Cache file the texels of mesh_texture point into (cached textures) */
+static mapped_file_t texel_mapping = { NULL, 0, NULL, NULL };
+
+static bool is_power_of_two(int value)
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+static int log2_of_power_of_two(int value)
+{
+    int bits = 0;
+
+    while ((1 << bits) < value) { bits++; }
+
+    return bits;
+}
+
+/**
+ * Offset tables of the texel layout of a level
+ * Morton order for power-of-two sizes: bit i of x goes to bit 2i and bit i of y to bit 2i + 1 of the
+ * offset; the extra high bits of the larger dimension of a rectangular level are stacked above.
+ */
+static bool build_level_offsets(texture_level_t* level)
+{
+    int width = level->width;
+    int height = level->height;
+
+    level->offsets_x = (uint32_t*)malloc(sizeof(uint32_t) * width);
+    level->offsets_y = (uint32_t*)malloc(sizeof(uint32_t) * height);
+
+    if (!level->offsets_x || !level->offsets_y) { return false; }
+
+    bool morton = is_power_of_two(width) && is_power_of_two(height);
+
+    level->width_mask = morton ? width - 1 : -1;
+    level->height_mask = morton ? height - 1 : -1;
+
+    if (!morton) {
+        for (int x = 0; x < width; x++) { level->offsets_x[x] = (uint32_t)x; }
+        for (int y = 0; y < height; y++) { level->offsets_y[y] = (uint32_t)(y * width); }
+        return true;
+    }
+
+    int width_bits = log2_of_power_of_two(width);
+    int height_bits = log2_of_power_of_two(height);
+    int shared_bits = (width_bits < height_bits) ? width_bits : height_bits;
+
+    for (int x = 0; x < width; x++) {
+        uint32_t offset = 0;
+
+        for (int bit = 0; bit < width_bits; bit++) {
+            int position = (bit < shared_bits) ? (2 * bit) : (shared_bits + bit);
+
+            offset |= (uint32_t)((x >> bit) & 1) << position;
+        }
+
+        level->offsets_x[x] = offset;
+    }
+
+    for (int y = 0; y < height; y++) {
+        uint32_t offset = 0;
+
+        for (int bit = 0; bit < height_bits; bit++) {
+            int position = (bit < shared_bits) ? (2 * bit + 1) : (shared_bits + bit);
+
+            offset |= (uint32_t)((y >> bit) & 1) << position;
+        }
+
+        level->offsets_y[y] = offset;
+    }
+
+    return true;
+}
+
+/**
+ * Reorder the row-major texels of a level in place into the layout of its offset tables
+ * 'scratch' holds at least width * height texels.
+ */
+static void swizzle_level(texture_level_t* level, uint32_t* scratch)
 {
-    png_texture = upng_new_from_file(filename);
+    if (level->width_mask < 0) { return; }
 
-    if (png_texture != NULL)
-    {
-        upng_decode(png_texture);
+    int width = level->width;
+    int height = level->height;
 
-        if (upng_get_error(png_texture) == UPNG_EOK)
-        {
-            mesh_texture = (uint32_t*)upng_get_buffer(png_texture);
+    memcpy(scratch, level->texels, sizeof(uint32_t) * width * height);
 
-            texture_width = upng_get_width(png_texture);
-            texture_height = upng_get_height(png_texture);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            level->texels[level->offsets_x[x] + level->offsets_y[y]] = scratch[(width * y) + x];
         }
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Average of four ARGB8888 texels, two channels at a time (rounded to nearest)
+ */
+static uint32_t average_texels(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    uint32_t redBlue = (a & 0x00FF00FF) + (b & 0x00FF00FF) + (c & 0x00FF00FF) + (d & 0x00FF00FF) + 0x00020002;
+    uint32_t alphaGreen = ((a >> 8) & 0x00FF00FF) + ((b >> 8) & 0x00FF00FF) + ((c >> 8) & 0x00FF00FF) + ((d >> 8) & 0x00FF00FF) + 0x00020002;
+
+    return ((redBlue >> 2) & 0x00FF00FF) | ((alphaGreen << 6) & 0xFF00FF00);
+}
+
+/**
+ * Box filter of a row-major power-of-two level into the next (half size, at least 1) level
+ */
+static void downsample_level(const texture_level_t* source, texture_level_t* target)
+{
+    int stepX = (source->width > 1) ? 1 : 0;
+    int stepY = (source->height > 1) ? source->width : 0;
+
+    for (int y = 0; y < target->height; y++) {
+        for (int x = 0; x < target->width; x++) {
+            const uint32_t* texel = &source->texels[(source->width * 2 * y) + (2 * x)];
+
+            target->texels[(target->width * y) + x] = average_texels(texel[0], texel[stepX], texel[stepY], texel[stepX + stepY]);
+        }
+    }
+}
+
+/**
+ * Size the levels of a texture and return the number of texels of all of them
+ * Power-of-two textures get a full mip chain, other sizes only their base level.
+ */
+static size_t size_texture_levels(texture_t* texture, int width, int height)
+{
+    bool chain = is_power_of_two(width) && is_power_of_two(height);
+    size_t num_texels = (size_t)width * height;
+
+    texture->levels[0].width = width;
+    texture->levels[0].height = height;
+    texture->num_levels = 1;
+
+    while (chain && (width > 1 || height > 1) && texture->num_levels < MAX_TEXTURE_LEVELS) {
+        width = (width > 1) ? width / 2 : 1;
+        height = (height > 1) ? height / 2 : 1;
+
+        texture->levels[texture->num_levels].width = width;
+        texture->levels[texture->num_levels].height = height;
+        texture->num_levels++;
+        num_texels += (size_t)width * height;
+    }
+
+    return num_texels;
+}
+
+/**
+ * Point the levels of a sized texture at consecutive blocks of 'texels'
+ */
+static void place_texture_levels(texture_t* texture, uint32_t* texels)
+{
+    for (int i = 0; i < texture->num_levels; i++) {
+        texture->levels[i].texels = texels;
+        texels += texture->levels[i].width * texture->levels[i].height;
+    }
+}
+
+/**
+ * Size the levels of a texture and allocate the texels of all of them in one block
+ */
+static bool allocate_texture_levels(texture_t* texture, int width, int height)
+{
+    texel_memory = (uint32_t*)malloc(sizeof(uint32_t) * size_texture_levels(texture, width, height));
+
+    if (!texel_memory) { return false; }
+
+    place_texture_levels(texture, texel_memory);
+
+    return true;
+}
+
+/**
+ * Build the mip chain of a texture from its row-major base level, then store every level in its layout
+ */
+static bool build_texture_levels(texture_t* texture)
+{
+    texture_level_t* base = &texture->levels[0];
+    uint32_t* scratch = (uint32_t*)malloc(sizeof(uint32_t) * base->width * base->height);
+
+    if (!scratch) { return false; }
+
+    for (int i = 1; i < texture->num_levels; i++) {
+        downsample_level(&texture->levels[i - 1], &texture->levels[i]);
+    }
+
+    /* Every level is downsampled from the row-major previous one, so they are only reordered at the end */
+    bool ok = true;
+
+    for (int i = 0; ok && i < texture->num_levels; i++) {
+        ok = build_level_offsets(&texture->levels[i]);
+
+        if (ok) { swizzle_level(&texture->levels[i], scratch); }
+    }
+
+    free(scratch);
+
+    return ok;
+}
+
+uint32_t texture_sample_bilinear(const texture_level_t* level, float x, float y)
+{
+    x -= 0.5f;
+    y -= 0.5f;
+
+    float floorX = floorf(x);
+    float floorY = floorf(y);
+    int x0 = (int)floorX;
+    int y0 = (int)floorY;
+
+    /* 8-bit blend weights of the right and bottom texels */
+    uint32_t weightX = (uint32_t)((x - floorX) * 256.0f);
+    uint32_t weightY = (uint32_t)((y - floorY) * 256.0f);
+
+    uint32_t texels[4] = {
+        texture_sample(level, x0, y0),
+        texture_sample(level, x0 + 1, y0),
+        texture_sample(level, x0, y0 + 1),
+        texture_sample(level, x0 + 1, y0 + 1)
+    };
+
+    /* Lerp two channels at a time: each 16-bit half of the products holds one channel times 256 */
+    uint32_t rows[2];
+
+    for (int i = 0; i < 2; i++) {
+        uint32_t left = texels[2 * i];
+        uint32_t right = texels[(2 * i) + 1];
+        uint32_t redBlue = (((left & 0x00FF00FF) * (256 - weightX)) + ((right & 0x00FF00FF) * weightX)) >> 8;
+        uint32_t alphaGreen = (((left >> 8) & 0x00FF00FF) * (256 - weightX)) + (((right >> 8) & 0x00FF00FF) * weightX);
+
+        rows[i] = (redBlue & 0x00FF00FF) | (alphaGreen & 0xFF00FF00);
+    }
+
+    uint32_t redBlue = (((rows[0] & 0x00FF00FF) * (256 - weightY)) + ((rows[1] & 0x00FF00FF) * weightY)) >> 8;
+    uint32_t alphaGreen = (((rows[0] >> 8) & 0x00FF00FF) * (256 - weightY)) + (((rows[1] >> 8) & 0x00FF00FF) * weightY);
+
+    return (redBlue & 0x00FF00FF) | (alphaGreen & 0xFF00FF00);
+}
+
+/**
+ * FNV-1a hash of 'size' bytes, continuing from 'hash'
+ */
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+/**
+ * Cache file of a PNG file and the key its content must match
+ * The file name only depends on the path, so an outdated cache file is overwritten, not left behind.
+ */
+static bool texture_cache_entry(const char* filename, char* cache_filename, size_t cache_filename_size, uint64_t* key)
+{
+    struct stat status;
+
+    if (stat(filename, &status) != 0) { return false; }
+
+    uint64_t path_hash = hash_bytes(0xCBF29CE484222325ull, filename, strlen(filename));
+    int64_t modified = (int64_t)status.st_mtime;
+    uint64_t size = (uint64_t)status.st_size;
+
+    *key = hash_bytes(hash_bytes(path_hash, &modified, sizeof(modified)), &size, sizeof(size));
+
+    int length = snprintf(cache_filename, cache_filename_size, "%s%016llx.htex", TEXTURE_CACHE_DIR, (unsigned long long)path_hash);
+
+    return length > 0 && (size_t)length < cache_filename_size;
+}
+
+/**
+ * Map a cache file and point the levels of mesh_texture at its texels when it matches 'key'
+ * A missing or outdated cache file is not an error, callers decode the PNG file.
+ */
+static bool load_texture_cache(const char* cache_filename, uint64_t key)
+{
+    mapped_file_t file;
+
+    /* The mapping is kept as the texel storage, which is sampled in any order */
+    if (!map_file(cache_filename, MAP_ACCESS_NORMAL, &file)) { return false; }
+
+    const texture_cache_header_t* header = (const texture_cache_header_t*)file.data;
+    bool valid = file.size >= sizeof(texture_cache_header_t) &&
+        header->magic == TEXTURE_CACHE_MAGIC &&
+        header->version == TEXTURE_CACHE_VERSION &&
+        header->header_size == sizeof(texture_cache_header_t) &&
+        header->texel_format == COLOR_BUFFER_FORMAT &&
+        header->key == key &&
+        header->width > 0 && header->width <= 65536 &&
+        header->height > 0 && header->height <= 65536 &&
+        header->texel_offset % 64 == 0;
+
+    size_t num_texels = valid ? size_texture_levels(&mesh_texture, (int)header->width, (int)header->height) : 0;
+
+    valid = valid &&
+        header->num_levels == (uint32_t)mesh_texture.num_levels &&
+        header->texel_offset <= file.size &&
+        num_texels <= (file.size - header->texel_offset) / sizeof(uint32_t);
+
+    if (!valid) {
+        memset(&mesh_texture, 0, sizeof(mesh_texture));
+        unmap_file(&file);
+        return false;
+    }
+
+    /* The texels are only read, the read-only mapping is shared with the page cache */
+    texel_mapping = file;
+    place_texture_levels(&mesh_texture, (uint32_t*)(file.data + header->texel_offset));
+
+    for (int i = 0; i < mesh_texture.num_levels; i++) {
+        if (!build_level_offsets(&mesh_texture.levels[i])) { return false; }
+    }
+
+    return true;
+}
+
+/**
+ * Move 'source' over 'target' in one step
+ * On POSIX systems a process that maps the old target keeps it until it unmaps it. Windows cannot
+ * replace a file mapped by another process, the move fails and the old target is left as is.
+ */
+static bool replace_file(const char* source, const char* target)
+{
+#ifdef _WIN32
+    return MoveFileExA(source, target, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(source, target) == 0;
+#endif
+}
+
+static bool save_texture_cache(const char* cache_filename, uint64_t key)
+{
+    /* Written next to the cache file and moved over it, so the cache file is never seen half written */
+    char temporary_filename[520];
+
+    snprintf(temporary_filename, sizeof(temporary_filename), "%s.tmp", cache_filename);
+
+    /* An existing directory is fine, a missing one shows up when the file is created */
+    make_directory(TEXTURE_CACHE_DIR);
+
+    FILE* file = fopen(temporary_filename, "wb");
+
+    if (!file) {
+        fprintf(stderr, "Error creating texture cache file %s.\n", cache_filename);
+        return false;
+    }
+
+    const texture_level_t* base = &mesh_texture.levels[0];
+    size_t num_texels = 0;
+
+    for (int i = 0; i < mesh_texture.num_levels; i++) {
+        num_texels += (size_t)mesh_texture.levels[i].width * mesh_texture.levels[i].height;
+    }
+
+    texture_cache_header_t header = {
+        .magic = TEXTURE_CACHE_MAGIC,
+        .version = TEXTURE_CACHE_VERSION,
+        .header_size = sizeof(texture_cache_header_t),
+        .texel_format = COLOR_BUFFER_FORMAT,
+        .key = key,
+        .width = (uint32_t)base->width,
+        .height = (uint32_t)base->height,
+        .num_levels = (uint32_t)mesh_texture.num_levels,
+        .reserved = 0,
+        .texel_offset = 64
+    };
+
+    static const unsigned char padding[64] = { 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    ok = ok && fwrite(padding, 1, header.texel_offset - sizeof(header), file) == header.texel_offset - sizeof(header);
+    ok = ok && fwrite(base->texels, sizeof(uint32_t), num_texels, file) == num_texels;
+
+    if (fclose(file) != 0) { ok = false; }
+
+    if (!ok) {
+        fprintf(stderr, "Error writing texture cache file %s.\n", cache_filename);
+        remove(temporary_filename);
+        return false;
+    }
+
+    /* Another instance mapping the cache file on Windows: the texture is decoded again next time */
+    if (!replace_file(temporary_filename, cache_filename)) {
+        fprintf(stderr, "Error replacing texture cache file %s (in use by another process?).\n", cache_filename);
+        remove(temporary_filename);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Textures are loaded from their cache file when it is up to date, with a single mapping and no decoding.
+ * Otherwise the PNG file is mapped and decoded straight into the base level, already in COLOR_BUFFER_FORMAT
+ * (ARGB8888) so texels are copied to the color buffer as they are, and the result is cached for the next run.
+ * Only the texels stay allocated (or mapped).
+ */
+bool load_png_texture_data(char* filename)
+{
+    free_png_texture();
+
+    char cache_filename[512];
+    uint64_t key = 0;
+    bool cached = texture_cache_entry(filename, cache_filename, sizeof(cache_filename), &key);
+
+    if (cached && load_texture_cache(cache_filename, key)) { return true; }
+
+    /* A cache file that matched but could not be used leaves nothing behind to decode into */
+    free_png_texture();
+
+    mapped_file_t file;
+    bool ok = false;
+
+    if (map_file(filename, MAP_ACCESS_SEQUENTIAL, &file)) {
+        upng_t* png = upng_new_from_bytes(file.data, (unsigned long)file.size);
+
+        if (png != NULL && upng_header(png) == UPNG_EOK) {
+            int width = (int)upng_get_width(png);
+            int height = (int)upng_get_height(png);
+
+            ok = width > 0 && height > 0 && allocate_texture_levels(&mesh_texture, width, height) &&
+                upng_decode_into(png, mesh_texture.levels[0].texels, sizeof(uint32_t) * width, UPNG_OUTPUT_ARGB8888) == UPNG_EOK &&
+                build_texture_levels(&mesh_texture);
+        }
+
+        if (png != NULL) { upng_free(png); }
+
+        unmap_file(&file);
+    }
+
+    if (ok) {
+        /* The texture is usable without its cache file, a failed write only costs the next startup */
+        if (cached) { save_texture_cache(cache_filename, key); }
+
+        return true;
+    }
+
+    fprintf(stderr, "Error loading PNG texture %s.\n", filename);
+
+    free_png_texture();
+
+    return false;
+}
+
+void free_png_texture(void)
+{
+    for (int i = 0; i < MAX_TEXTURE_LEVELS; i++) {
+        free(mesh_texture.levels[i].offsets_x);
+        free(mesh_texture.levels[i].offsets_y);
+    }
+
+    /* Cached textures point into the cache file, decoded textures own their texels */
+    if (texel_mapping.data) {
+        unmap_file(&texel_mapping);
+    } else {
+        free(texel_memory);
+    }
+
+    texel_memory = NULL;
+    memset(&mesh_texture, 0, sizeof(mesh_texture));
+}
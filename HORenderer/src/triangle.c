@@ -1,116 +1,471 @@
+#include <math.h>
+
 #include "display.h"
 #include "triangle.h"
-#include "swap.h"
+#include "light.h"
+#include "simd.h"
+
+/**
+ * Pixels are shaded in horizontal blocks of PIXEL_BLOCK_WIDTH.
+ * Every lane value is computed as (block value + lane offset) both in the SIMD kernels and in the
+ * scalar fallback, so both paths perform the same float operations and produce identical output.
+ */
+#define PIXEL_BLOCK_WIDTH       4
+
+/**
+ * Sub-pixel precision: vertex positions are snapped to 28.4 fixed point (1/16 pixel) and pixels are
+ * sampled at their centers, so the coverage of a pixel only depends on the snapped vertices.
+ */
+#define SUBPIXEL_BITS           4
+#define SUBPIXEL_ONE            (1 << SUBPIXEL_BITS)
+#define SUBPIXEL_HALF           (SUBPIXEL_ONE / 2)
+
+/**
+ * Edge functions of guard band sized triangles do not fit in 32 bits, so they are tracked in 64 bits
+ * per block and saturated to +/-EDGE_LIMIT for the lanes of the block. A saturated value keeps its
+ * sign over the few lanes of a block as long as the per-pixel step stays below EDGE_LIMIT / PIXEL_BLOCK_WIDTH,
+ * which holds for any edge shorter than millions of pixels.
+ */
+#define EDGE_LIMIT              (1 << 30)
+
+/**
+ * Half-space rasterization setup
+ * Every pixel of the bounding box is tested against the three edge functions of the triangle.
+ * The edge functions (and every attribute interpolated with them) are affine in x and y,
+ * so they are advanced with constant deltas instead of being recomputed per pixel.
+ * Edge functions are in 8.8 fixed point (products of 28.4 coordinates) and include the fill rule bias.
+ */
+typedef struct {
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+    int64_t edgeRow[3];                         // edge function values at the center of pixel (minX, minY)
+    int edgeStepX[3];                           // edge function deltas per pixel
+    int edgeStepY[3];                           // edge function deltas per row
+    int edgeStepBlock[3];                       // edge function deltas per pixel block
+    int edgeLane[3][PIXEL_BLOCK_WIDTH];         // edge function offsets of each lane in a block
+    int edgeBias[3];                            // top-left fill rule bias (already added to edgeRow)
+    double invArea;
+    raster_stats_t* stats;                      // counters of the calling thread, NULL when not counting
+} raster_setup_t;
+
+#ifdef HAS_SSE2
+/**
+ * Number of set bits of a 4-bit lane mask (of the SSE2 kernels)
+ */
+static const int laneCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+#endif
+
+/**
+ * Attribute plane: value at (minX, minY) and constant deltas per pixel, per row and per block
+ */
+typedef struct {
+    float origin;
+    float dx;
+    float dy;
+    float dxBlock;
+    float lane[PIXEL_BLOCK_WIDTH];
+} plane_t;
+
+/**
+ * Edge function of the directed edge (a -> b) evaluated at p (28.4 coordinates, 64-bit result)
+ * Twice the signed area of the triangle (a, b, p)
+ */
+static int64_t edgeFunction(int ax, int ay, int bx, int by, int px, int py) {
+    return ((int64_t)(bx - ax) * (py - ay)) - ((int64_t)(by - ay) * (px - ax));
+}
 
-vec3_t barycentricWeights(vec2_t a, vec2_t b, vec2_t c, vec2_t p)
-{
-    vec2_t ac = vec2_sub(c, a);
-    vec2_t ab = vec2_sub(b, a);
-    vec2_t pc = vec2_sub(c, p);
-    vec2_t pb = vec2_sub(b, p);
-    vec2_t ap = vec2_sub(p, a);
+static int toSubpixel(float value) {
+    return (int)floorf((value * SUBPIXEL_ONE) + 0.5f);
+}
 
-    /**
-     * Area of the full paralleleogram (triangle ABC) using cross product
-     * | ac.x | \/ | ab.x |
-     * | ac.y | /\ | ab.y |
-     * ac.x * ab.y - ac.y * ab.x
-     */
-    float areaParallelogramABC = (ac.x * ab.y) - (ac.y * ab.x);
+static inline int saturateEdge(int64_t value) {
+    if (value > EDGE_LIMIT) { return EDGE_LIMIT; }
+    if (value < -EDGE_LIMIT) { return -EDGE_LIMIT; }
+    return (int)value;
+}
+
+static bool setupTriangle(raster_setup_t* s, float fx0, float fy0, float fx1, float fy1, float fx2, float fy2, ClipRect clip, raster_stats_t* stats) {
+    s->stats = stats;
+
+    int x0 = toSubpixel(fx0);
+    int y0 = toSubpixel(fy0);
+    int x1 = toSubpixel(fx1);
+    int y1 = toSubpixel(fy1);
+    int x2 = toSubpixel(fx2);
+    int y2 = toSubpixel(fy2);
+
+    int64_t area = edgeFunction(x0, y0, x1, y1, x2, y2);
+
+    /* Degenerate triangles cover no pixel */
+    if (area == 0) { return false; }
+
+    /* Pixels whose centers can be inside, clamped to the clip rect so the pixel loop needs no bounds check */
+    int minFx = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
+    int minFy = y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2);
+    int maxFx = x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2);
+    int maxFy = y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2);
+
+    s->minX = (minFx - SUBPIXEL_HALF + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+    s->minY = (minFy - SUBPIXEL_HALF + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+    s->maxX = (maxFx - SUBPIXEL_HALF) >> SUBPIXEL_BITS;
+    s->maxY = (maxFy - SUBPIXEL_HALF) >> SUBPIXEL_BITS;
+
+    if (s->minX < clip.minX) { s->minX = clip.minX; }
+    if (s->minY < clip.minY) { s->minY = clip.minY; }
+    if (s->maxX > clip.maxX) { s->maxX = clip.maxX; }
+    if (s->maxY > clip.maxY) { s->maxY = clip.maxY; }
+
+    if (s->minX > s->maxX || s->minY > s->maxY) { return false; }
 
     /**
-     * Alpha = area of parallelogram PBC over the area of the full parallelogram ABC
-     * || PC x PB ||
-     * -------------
-     * || AC x AB ||
-     * 
-     * Beta = area of parallelogram APC over the area of the full parallelogram ABC
-     * || AC x AP ||
-     * -------------
-     * || AC x AB ||
-     * 
-     * Gamma can be easily found since barycentric coordinates alwasy add up to 1.0
-     * gamma = 1.0 - alpha - beta
+     * Edge k is the edge opposite to vertex k, so its value is the (unnormalized) weight of vertex k
+     * E(a, b, p) = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x)
+     * dE/dx = a.y - b.y, dE/dy = b.x - a.x (per pixel: times SUBPIXEL_ONE)
      */
-    float alpha = ((pc.x * pb.y) - (pc.y * pb.x)) / areaParallelogramABC;
-    float beta = ((ac.x * ap.y) - (ac.y * ap.x)) / areaParallelogramABC;
-    float gamma = 1.0 - alpha - beta;
+    int centerX = (s->minX << SUBPIXEL_BITS) + SUBPIXEL_HALF;
+    int centerY = (s->minY << SUBPIXEL_BITS) + SUBPIXEL_HALF;
+
+    s->edgeRow[0] = edgeFunction(x1, y1, x2, y2, centerX, centerY);
+    s->edgeRow[1] = edgeFunction(x2, y2, x0, y0, centerX, centerY);
+    s->edgeRow[2] = edgeFunction(x0, y0, x1, y1, centerX, centerY);
+
+    s->edgeStepX[0] = (y1 - y2) * SUBPIXEL_ONE;
+    s->edgeStepX[1] = (y2 - y0) * SUBPIXEL_ONE;
+    s->edgeStepX[2] = (y0 - y1) * SUBPIXEL_ONE;
+
+    s->edgeStepY[0] = (x2 - x1) * SUBPIXEL_ONE;
+    s->edgeStepY[1] = (x0 - x2) * SUBPIXEL_ONE;
+    s->edgeStepY[2] = (x1 - x0) * SUBPIXEL_ONE;
+
+    /* Flip the edges of clockwise triangles so the inside is always where all edges are >= 0 */
+    if (area < 0) {
+        for (int i = 0; i < 3; i++) {
+            s->edgeRow[i] = -s->edgeRow[i];
+            s->edgeStepX[i] = -s->edgeStepX[i];
+            s->edgeStepY[i] = -s->edgeStepY[i];
+        }
+        area = -area;
+    }
+
+    s->invArea = 1.0 / (double)area;
 
-    vec3_t weights = {alpha, beta, gamma};
+    for (int i = 0; i < 3; i++) {
+        /**
+         * Top-left fill rule: a pixel center exactly on an edge belongs to the triangle only if the
+         * edge is a left edge (inside to its right) or a top edge (horizontal, inside below it),
+         * so pixels on an edge shared by two triangles are drawn exactly once.
+         * E is an integer, so E > 0 on the other edges is E - 1 >= 0.
+         */
+        bool topLeft = (s->edgeStepX[i] > 0) || (s->edgeStepX[i] == 0 && s->edgeStepY[i] > 0);
 
-    return weights;
+        s->edgeBias[i] = topLeft ? 0 : -1;
+        s->edgeRow[i] += s->edgeBias[i];
+        s->edgeStepBlock[i] = s->edgeStepX[i] * PIXEL_BLOCK_WIDTH;
+
+        for (int k = 0; k < PIXEL_BLOCK_WIDTH; k++) {
+            s->edgeLane[i][k] = s->edgeStepX[i] * k;
+        }
+    }
+
+    return true;
 }
 
-void drawTrianglePixel(Point p, uint32_t color, vec4_t pointA, vec4_t pointB, vec4_t pointC) {
-    /* Create three vec2 to find the interpolation */
-    vec2_t targetPoint = {p.x, p.y};
-    vec2_t a = vec2_from_vec4(pointA);
-    vec2_t b = vec2_from_vec4(pointB);
-    vec2_t c = vec2_from_vec4(pointC);
+static plane_t makePlane(const raster_setup_t* s, float a, float b, float c) {
+    plane_t plane;
+
+    /* Barycentric weights from the unbiased edge values */
+    double e0 = (double)(s->edgeRow[0] - s->edgeBias[0]);
+    double e1 = (double)(s->edgeRow[1] - s->edgeBias[1]);
+    double e2 = (double)(s->edgeRow[2] - s->edgeBias[2]);
 
-    /* Calculate barycentric coordinates of 'targetPoint' which is inside the triangle */
-    vec3_t weights = barycentricWeights(a, b, c, targetPoint);
+    plane.origin = (float)(((a * e0) + (b * e1) + (c * e2)) * s->invArea);
+    plane.dx = (float)((((double)a * s->edgeStepX[0]) + ((double)b * s->edgeStepX[1]) + ((double)c * s->edgeStepX[2])) * s->invArea);
+    plane.dy = (float)((((double)a * s->edgeStepY[0]) + ((double)b * s->edgeStepY[1]) + ((double)c * s->edgeStepY[2])) * s->invArea);
+    plane.dxBlock = plane.dx * PIXEL_BLOCK_WIDTH;
 
-    float alpha = weights.x;
-    float beta = weights.y;
-    float gamma = weights.z;
+    for (int k = 0; k < PIXEL_BLOCK_WIDTH; k++) {
+        plane.lane[k] = plane.dx * k;
+    }
 
-    /* Interpolate the value of 1/w for the current pixel */
-    float interpolatedReciprocalW = (1 / pointA.w) * alpha + (1 / pointB.w) * beta + (1 / pointC.w) * gamma;
+    return plane;
+}
 
+static inline bool drawTrianglePixel(int index, uint32_t color, float reciprocalW) {
     /* Adjust 1/w so the pixels that are closer to the camera have smaller values */
-    interpolatedReciprocalW = 1.0 - interpolatedReciprocalW;
+    float depth = 1.0f - reciprocalW;
 
     /* Only draw the pixel if the depth value is less than the one previously stored in the z-buffer */
-    if (interpolatedReciprocalW < zBuffer[(windowWidth * p.y) + p.x]) {
-        drawPixel(p, color);
+    if (depth < zBuffer[index]) {
+        colorBuffer[index] = color;
+        zBuffer[index] = depth;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Texture a pixel that passed the depth test
+ */
+static inline void drawTriangleTexel(int index, const texture_level_t* level, bool bilinear, float reciprocalW, float uOverW, float vOverW) {
+    /* Divide back both interpolated values by 1/w (one reciprocal per pixel) */
+    float w = 1.0f / reciprocalW;
+
+    /* Map the UV coordinate to the full width and height of the mip level */
+    float texelX = uOverW * w * level->width;
+    float texelY = vOverW * w * level->height;
+
+    colorBuffer[index] = bilinear ? texture_sample_bilinear(level, texelX, texelY) : texture_sample(level, (int)texelX, (int)texelY);
+    zBuffer[index] = 1.0f - reciprocalW;
+}
+
+/**
+ * Mip level of a span (the covered pixels of a row), from the texel footprint of the first pixel of its
+ * first block with a visible pixel, so the log2 is computed once per row instead of once per block
+ * u = (u/w) / (1/w), so du/dx = (d(u/w)/dx - u * d(1/w)/dx) * w, and the same for v and for y.
+ * The level is log2 of the longest side of the footprint (in base level texels), rounded to the nearest level.
+ */
+static const texture_level_t* selectMipLevel(const texture_t* texture, const plane_t* planes, const float values[3]) {
+    const texture_level_t* base = &texture->levels[0];
+
+    if (FilterMethod == FILTER_NEAREST || texture->num_levels == 1 || values[0] <= 0.0f) { return base; }
+
+    float w = 1.0f / values[0];
+    float u = values[1] * w;
+    float v = values[2] * w;
+    float dudx = (planes[1].dx - (u * planes[0].dx)) * w * base->width;
+    float dvdx = (planes[2].dx - (v * planes[0].dx)) * w * base->height;
+    float dudy = (planes[1].dy - (u * planes[0].dy)) * w * base->width;
+    float dvdy = (planes[2].dy - (v * planes[0].dy)) * w * base->height;
+    float footprintX = (dudx * dudx) + (dvdx * dvdx);
+    float footprintY = (dudy * dudy) + (dvdy * dvdy);
+    float footprint = (footprintX > footprintY) ? footprintX : footprintY;
+
+    /* log2 of the footprint length is half the log2 of its square, NaN and magnified footprints use the base level */
+    int level = (footprint > 1.0f) ? (int)((0.5f * log2f(footprint)) + 0.5f) : 0;
+
+    if (level > texture->num_levels - 1) { level = texture->num_levels - 1; }
+
+    return &texture->levels[level];
+}
+
+/**
+ * Per-block statistics: covered pixels go through the depth test, the ones that fail it are wasted work
+ * 'texelsPerPixel' is the number of texels the filter reads for every shaded pixel (0 when untextured)
+ */
+static inline void countBlock(raster_stats_t* stats, int covered, int passed, int texelsPerPixel) {
+    stats->pixelsTested += covered;
+    stats->depthFailed += covered - passed;
+    stats->texelsFetched += passed * texelsPerPixel;
+}
+
+/**
+ * Shade 'lanes' (<= PIXEL_BLOCK_WIDTH) pixels starting at 'index'.
+ * 'e' holds the edge function values and 'reciprocalW' the 1/w value of the first pixel of the block.
+ * With 'countOverdraw' the pixels that pass the depth test increment the color buffer value instead.
+ */
+static void drawFilledBlock(const raster_setup_t* s, const plane_t* reciprocalWPlane, int index, int lanes, const int e[3], float reciprocalW, uint32_t color, bool countOverdraw) {
+#ifdef HAS_SSE2
+    if (lanes == PIXEL_BLOCK_WIDTH) {
+        /* Coverage: a lane is inside when the OR of its three edge values has no sign bit */
+        __m128i e0 = _mm_add_epi32(_mm_set1_epi32(e[0]), _mm_loadu_si128((const __m128i*)s->edgeLane[0]));
+        __m128i e1 = _mm_add_epi32(_mm_set1_epi32(e[1]), _mm_loadu_si128((const __m128i*)s->edgeLane[1]));
+        __m128i e2 = _mm_add_epi32(_mm_set1_epi32(e[2]), _mm_loadu_si128((const __m128i*)s->edgeLane[2]));
+        __m128i inside = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(e0, e1), e2), _mm_set1_epi32(-1));
+
+        if (_mm_movemask_epi8(inside) == 0) { return; }
+
+        /* Depth test as a mask */
+        __m128 laneReciprocalW = _mm_add_ps(_mm_set1_ps(reciprocalW), _mm_loadu_ps(reciprocalWPlane->lane));
+        __m128 depth = _mm_sub_ps(_mm_set1_ps(1.0f), laneReciprocalW);
+        __m128 oldDepth = _mm_loadu_ps(&zBuffer[index]);
+        __m128 pass = _mm_and_ps(_mm_cmplt_ps(depth, oldDepth), _mm_castsi128_ps(inside));
+        int passBits = _mm_movemask_ps(pass);
+
+        if (s->stats) { countBlock(s->stats, laneCount[_mm_movemask_ps(_mm_castsi128_ps(inside))], laneCount[passBits], 0); }
+
+        if (passBits == 0) { return; }
+
+        /* Masked stores (the block never leaves the clip rect, so read-modify-write is safe) */
+        __m128i passMask = _mm_castps_si128(pass);
+        __m128i oldColor = _mm_loadu_si128((const __m128i*)&colorBuffer[index]);
+        __m128i newColor = countOverdraw
+            ? _mm_sub_epi32(oldColor, passMask)     // passing lanes are -1
+            : _mm_or_si128(_mm_and_si128(passMask, _mm_set1_epi32((int)color)), _mm_andnot_si128(passMask, oldColor));
+
+        _mm_storeu_ps(&zBuffer[index], _mm_or_ps(_mm_and_ps(pass, depth), _mm_andnot_ps(pass, oldDepth)));
+        _mm_storeu_si128((__m128i*)&colorBuffer[index], newColor);
+        return;
+    }
+#endif
+
+    int covered = 0;
+    int passed = 0;
+
+    for (int k = 0; k < lanes; k++) {
+        if (((e[0] + s->edgeLane[0][k]) | (e[1] + s->edgeLane[1][k]) | (e[2] + s->edgeLane[2][k])) >= 0) {
+            uint32_t value = countOverdraw ? colorBuffer[index + k] + 1 : color;
 
-        /* Update the z-buffer value with the 1/w of this current pixel */
-        zBuffer[(windowWidth * p.y) + p.x] = interpolatedReciprocalW;
+            covered++;
+            passed += drawTrianglePixel(index + k, value, reciprocalW + reciprocalWPlane->lane[k]);
+        }
     }
+
+    if (s->stats) { countBlock(s->stats, covered, passed, 0); }
 }
 
-void drawTriangleTexel(Point p, uint32_t* texture, vec4_t pointA, vec4_t pointB, vec4_t pointC, tex2_t aUV, tex2_t bUV, tex2_t cUV) {
-    vec2_t targetPoint = {p.x, p.y};
-    vec2_t a = vec2_from_vec4(pointA);
-    vec2_t b = vec2_from_vec4(pointB);
-    vec2_t c = vec2_from_vec4(pointC);
+/**
+ * Gouraud variant of drawFilledBlock(): 'shade' is the light intensity of the first pixel of the block.
+ * The lit colors are computed per lane (like the texels), only for the lanes that pass the depth test.
+ */
+static void drawShadedBlock(const raster_setup_t* s, const plane_t* planes, int index, int lanes, const int e[3], const float values[2], uint32_t color) {
+#ifdef HAS_SSE2
+    if (lanes == PIXEL_BLOCK_WIDTH) {
+        __m128i e0 = _mm_add_epi32(_mm_set1_epi32(e[0]), _mm_loadu_si128((const __m128i*)s->edgeLane[0]));
+        __m128i e1 = _mm_add_epi32(_mm_set1_epi32(e[1]), _mm_loadu_si128((const __m128i*)s->edgeLane[1]));
+        __m128i e2 = _mm_add_epi32(_mm_set1_epi32(e[2]), _mm_loadu_si128((const __m128i*)s->edgeLane[2]));
+        __m128i inside = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(e0, e1), e2), _mm_set1_epi32(-1));
 
-    /* Calculate the barycentric coordinates of our point 'p' inside the triangle */
-    vec3_t weights = barycentricWeights(a, b, c, targetPoint);
+        if (_mm_movemask_epi8(inside) == 0) { return; }
 
-    float alpha = weights.x;
-    float beta = weights.y;
-    float gamma = weights.z;
+        __m128 laneReciprocalW = _mm_add_ps(_mm_set1_ps(values[0]), _mm_loadu_ps(planes[0].lane));
+        __m128 depth = _mm_sub_ps(_mm_set1_ps(1.0f), laneReciprocalW);
+        __m128 oldDepth = _mm_loadu_ps(&zBuffer[index]);
+        __m128 pass = _mm_and_ps(_mm_cmplt_ps(depth, oldDepth), _mm_castsi128_ps(inside));
+        int passBits = _mm_movemask_ps(pass);
 
-    /* Variables to store the interpolated values of U, V, and also 1/w for the current pixel */
-    float interpolatedU;
-    float interpolatedV;
-    float interpolatedReciprocalW;
+        if (s->stats) { countBlock(s->stats, laneCount[_mm_movemask_ps(_mm_castsi128_ps(inside))], laneCount[passBits], 0); }
 
-    /* Perform the interpolation of all U/w and V/w values using barycentric weights and a factor of 1/w */
-    interpolatedU = (aUV.u / pointA.w) * alpha + (bUV.u / pointB.w) * beta + (cUV.u / pointC.w) * gamma;
-    interpolatedV = (aUV.v / pointA.w) * alpha + (bUV.v / pointB.w) * beta + (cUV.v / pointC.w) * gamma;
+        if (passBits == 0) { return; }
 
-    interpolatedReciprocalW = (1 / pointA.w) * alpha + (1 / pointB.w) * beta + (1 / pointC.w) * gamma;
+        uint32_t colors[PIXEL_BLOCK_WIDTH] = { 0 };
 
-    /* Divide back both interpolated values by 1/w */
-    interpolatedU /= interpolatedReciprocalW;
-    interpolatedV /= interpolatedReciprocalW;
+        for (int k = 0; k < PIXEL_BLOCK_WIDTH; k++) {
+            if (passBits & (1 << k)) {
+                colors[k] = light_apply_intensity(color, values[1] + planes[1].lane[k]);
+            }
+        }
 
-    /* Map the UV coordinate to the full texture width and height */
-    int texX = abs((int)(interpolatedU * texture_width)) % texture_width;
-    int texY = abs((int)(interpolatedV * texture_height)) % texture_height;
+        __m128i passMask = _mm_castps_si128(pass);
+        __m128i oldColor = _mm_loadu_si128((const __m128i*)&colorBuffer[index]);
+        __m128i newColor = _mm_or_si128(_mm_and_si128(passMask, _mm_loadu_si128((const __m128i*)colors)), _mm_andnot_si128(passMask, oldColor));
 
-    interpolatedReciprocalW = 1.0 - interpolatedReciprocalW;
+        _mm_storeu_ps(&zBuffer[index], _mm_or_ps(_mm_and_ps(pass, depth), _mm_andnot_ps(pass, oldDepth)));
+        _mm_storeu_si128((__m128i*)&colorBuffer[index], newColor);
+        return;
+    }
+#endif
 
-    /* Only draw the pixel if the depth value is less thant the one previously stored in the z-buffer */
-    if (interpolatedReciprocalW < zBuffer[(windowWidth * p.y) + p.x]) {
-        drawPixel(p, texture[(texture_width * texY) + texX]);
+    int covered = 0;
+    int passed = 0;
 
-        /* Update the z-buffer value with the 1/w of this current pixel */
-        zBuffer[(windowWidth * p.y) + p.x] = interpolatedReciprocalW;
+    for (int k = 0; k < lanes; k++) {
+        if (((e[0] + s->edgeLane[0][k]) | (e[1] + s->edgeLane[1][k]) | (e[2] + s->edgeLane[2][k])) >= 0) {
+            covered++;
+            passed += drawTrianglePixel(index + k, light_apply_intensity(color, values[1] + planes[1].lane[k]), values[0] + planes[0].lane[k]);
+        }
     }
+
+    if (s->stats) { countBlock(s->stats, covered, passed, 0); }
+}
+
+/**
+ * Textured variant of drawFilledBlock(): '*level' is the mip level of the span, NULL until a block of the row
+ * has a pixel that passes the depth test (hidden spans never select a level)
+ */
+static void drawTexturedBlock(const raster_setup_t* s, const plane_t* planes, int index, int lanes, const int e[3], const float values[3], const texture_t* texture, const texture_level_t** level) {
+    bool bilinear = (FilterMethod == FILTER_MIP_BILINEAR);
+    int texelsPerPixel = bilinear ? 4 : 1;
+
+#ifdef HAS_SSE2
+    if (lanes == PIXEL_BLOCK_WIDTH) {
+        __m128i e0 = _mm_add_epi32(_mm_set1_epi32(e[0]), _mm_loadu_si128((const __m128i*)s->edgeLane[0]));
+        __m128i e1 = _mm_add_epi32(_mm_set1_epi32(e[1]), _mm_loadu_si128((const __m128i*)s->edgeLane[1]));
+        __m128i e2 = _mm_add_epi32(_mm_set1_epi32(e[2]), _mm_loadu_si128((const __m128i*)s->edgeLane[2]));
+        __m128i inside = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(e0, e1), e2), _mm_set1_epi32(-1));
+
+        if (_mm_movemask_epi8(inside) == 0) { return; }
+
+        __m128 laneReciprocalW = _mm_add_ps(_mm_set1_ps(values[0]), _mm_loadu_ps(planes[0].lane));
+        __m128 depth = _mm_sub_ps(_mm_set1_ps(1.0f), laneReciprocalW);
+        __m128 oldDepth = _mm_loadu_ps(&zBuffer[index]);
+        __m128 pass = _mm_and_ps(_mm_cmplt_ps(depth, oldDepth), _mm_castsi128_ps(inside));
+        int passBits = _mm_movemask_ps(pass);
+
+        if (s->stats) { countBlock(s->stats, laneCount[_mm_movemask_ps(_mm_castsi128_ps(inside))], laneCount[passBits], texelsPerPixel); }
+
+        if (passBits == 0) { return; }
+
+        if (!*level) { *level = selectMipLevel(texture, planes, values); }
+
+        /* Perspective-correct UVs for the four lanes, scaled to texel coordinates of the mip level */
+        __m128 w = _mm_div_ps(_mm_set1_ps(1.0f), laneReciprocalW);
+        __m128 u = _mm_add_ps(_mm_set1_ps(values[1]), _mm_loadu_ps(planes[1].lane));
+        __m128 v = _mm_add_ps(_mm_set1_ps(values[2]), _mm_loadu_ps(planes[2].lane));
+        __m128 texelX = _mm_mul_ps(_mm_mul_ps(u, w), _mm_set1_ps((float)(*level)->width));
+        __m128 texelY = _mm_mul_ps(_mm_mul_ps(v, w), _mm_set1_ps((float)(*level)->height));
+        uint32_t texels[PIXEL_BLOCK_WIDTH] = { 0 };
+
+        /* The wrap-around and the fetch itself are scalar gathers, only for the lanes that passed */
+        if (bilinear) {
+            float texX[PIXEL_BLOCK_WIDTH];
+            float texY[PIXEL_BLOCK_WIDTH];
+
+            _mm_storeu_ps(texX, texelX);
+            _mm_storeu_ps(texY, texelY);
+
+            for (int k = 0; k < PIXEL_BLOCK_WIDTH; k++) {
+                if (passBits & (1 << k)) {
+                    texels[k] = texture_sample_bilinear(*level, texX[k], texY[k]);
+                }
+            }
+        } else {
+            int texX[PIXEL_BLOCK_WIDTH];
+            int texY[PIXEL_BLOCK_WIDTH];
+
+            /* Truncated like the scalar (int) conversion */
+            _mm_storeu_si128((__m128i*)texX, _mm_cvttps_epi32(texelX));
+            _mm_storeu_si128((__m128i*)texY, _mm_cvttps_epi32(texelY));
+
+            for (int k = 0; k < PIXEL_BLOCK_WIDTH; k++) {
+                if (passBits & (1 << k)) {
+                    texels[k] = texture_sample(*level, texX[k], texY[k]);
+                }
+            }
+        }
+
+        __m128i passMask = _mm_castps_si128(pass);
+        __m128i oldColor = _mm_loadu_si128((const __m128i*)&colorBuffer[index]);
+        __m128i newColor = _mm_or_si128(_mm_and_si128(passMask, _mm_loadu_si128((const __m128i*)texels)), _mm_andnot_si128(passMask, oldColor));
+
+        _mm_storeu_ps(&zBuffer[index], _mm_or_ps(_mm_and_ps(pass, depth), _mm_andnot_ps(pass, oldDepth)));
+        _mm_storeu_si128((__m128i*)&colorBuffer[index], newColor);
+        return;
+    }
+#endif
+
+    int covered = 0;
+    int passed = 0;
+
+    for (int k = 0; k < lanes; k++) {
+        if (((e[0] + s->edgeLane[0][k]) | (e[1] + s->edgeLane[1][k]) | (e[2] + s->edgeLane[2][k])) >= 0) {
+            float reciprocalW = values[0] + planes[0].lane[k];
+
+            covered++;
+
+            /* The depth test runs first so hidden pixels skip the level selection, the divide and the texture fetch */
+            if (1.0f - reciprocalW < zBuffer[index + k]) {
+                if (!*level) { *level = selectMipLevel(texture, planes, values); }
+
+                drawTriangleTexel(index + k, *level, bilinear, reciprocalW, values[1] + planes[1].lane[k], values[2] + planes[2].lane[k]);
+                passed++;
+            }
+        }
+    }
+
+    if (s->stats) { countBlock(s->stats, covered, passed, texelsPerPixel); }
 }
 
 void drawTriangle(Point p0, Point p1, Point p2, uint32_t color) {
@@ -119,127 +474,143 @@ void drawTriangle(Point p0, Point p1, Point p2, uint32_t color) {
     drawLine(p2, p0, color);
 }
 
-void drawFilledTriangle(Point4 p0, Point4 p1, Point4 p2, uint32_t color) {
-    /* Sort the vertices by y-coordinate ascending (y0 < y1 < y2) */
-    if (p0.y > p1.y) { swapPoint4(&p0, &p1); }
-    if (p1.y > p2.y) { swapPoint4(&p1, &p2); }
-    if (p0.y > p1.y) { swapPoint4(&p0, &p1); }
+ClipRect screenClipRect(void) {
+    ClipRect clip = { 0, 0, windowWidth - 1, windowHeight - 1 };
 
-    vec4_t pointA = {p0.x, p0.y, p0.z, p0.w};
-    vec4_t pointB = {p1.x, p1.y, p1.z, p1.w};
-    vec4_t pointC = {p2.x, p2.y, p2.z, p2.w};
+    return clip;
+}
 
-    /**
-     * Render the upper part of the triangle (Flat-Bottom)
-     */
-    float invSlope1 = 0;
-    float invSlope2 = 0;
+void drawFilledTriangle(Point4 p0, Point4 p1, Point4 p2, uint32_t color) {
+    drawFilledTriangleClipped(p0, p1, p2, color, screenClipRect(), NULL);
+}
 
-    if (p1.y - p0.y != 0) { invSlope1 = (float)(p1.x - p0.x) / abs(p1.y - p0.y); }
-    if (p2.y - p0.y != 0) { invSlope2 = (float)(p2.x - p0.x) / abs(p2.y - p0.y); }
+static void rasterizeFilledTriangle(Point4 p0, Point4 p1, Point4 p2, uint32_t color, ClipRect clip, raster_stats_t* stats, bool countOverdraw) {
+    raster_setup_t s;
 
-    if (p1.y - p0.y != 0) {
-        for (int y = p0.y; y < p1.y; y++) {
-            int xStart = p1.x + (y - p1.y) * invSlope1;
-            int xEnd = p0.x + (y - p0.y) * invSlope2;
+    if (!setupTriangle(&s, p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, clip, stats)) { return; }
 
-            if (xEnd < xStart) { int_swap(&xStart, &xEnd); }
+    plane_t reciprocalW = makePlane(&s, 1.0f / p0.w, 1.0f / p1.w, 1.0f / p2.w);
 
-            for (int x = xStart; x < xEnd; x++) {
-                Point pixelToDraw = {x, y};
-                drawTrianglePixel(pixelToDraw, color, pointA, pointB, pointC);
-            }
-        }
-    }
+    int64_t eRow[3] = { s.edgeRow[0], s.edgeRow[1], s.edgeRow[2] };
+    float reciprocalWRow = reciprocalW.origin;
 
-    /**
-     * Render the bottom part of the triangle (Flat-Top)
-     */
-    invSlope1 = 0;
-    invSlope2 = 0;
+    for (int y = s.minY; y <= s.maxY; y++) {
+        int64_t eBlock[3] = { eRow[0], eRow[1], eRow[2] };
+        float interpolatedReciprocalW = reciprocalWRow;
+        int index = (colorBufferPitch * y) + s.minX;
 
-    if (p2.y - p1.y != 0) { invSlope1 = (float)(p2.x - p1.x) / abs(p2.y - p1.y); }
-    if (p2.y - p0.y != 0) { invSlope2 = (float)(p2.x - p0.x) / abs(p2.y - p0.y); }
+        for (int x = s.minX; x <= s.maxX; x += PIXEL_BLOCK_WIDTH, index += PIXEL_BLOCK_WIDTH) {
+            int lanes = (s.maxX - x + 1 < PIXEL_BLOCK_WIDTH) ? (s.maxX - x + 1) : PIXEL_BLOCK_WIDTH;
+            int e[3] = { saturateEdge(eBlock[0]), saturateEdge(eBlock[1]), saturateEdge(eBlock[2]) };
 
-    if (p2.y - p1.y != 0) {
-        for (int y = p1.y; y <= p2.y; y++) {
-            int xStart = p1.x + (y - p1.y) * invSlope1;
-            int xEnd = p0.x + (y - p0.y) * invSlope2;
+            drawFilledBlock(&s, &reciprocalW, index, lanes, e, interpolatedReciprocalW, color, countOverdraw);
 
-            if (xEnd < xStart) { int_swap(&xStart, &xEnd); }
-            for (int x = xStart; x < xEnd; x++) {
-                Point pixelToDraw = {x, y};
-                drawTrianglePixel(pixelToDraw, color, pointA, pointB, pointC);
+            for (int i = 0; i < 3; i++) {
+                eBlock[i] += s.edgeStepBlock[i];
             }
+            interpolatedReciprocalW += reciprocalW.dxBlock;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            eRow[i] += s.edgeStepY[i];
         }
+        reciprocalWRow += reciprocalW.dy;
     }
 }
 
-void drawTexturedTriangle(TexturePoint p0, TexturePoint p1, TexturePoint p2, uint32_t* texture) {
-    /* Sort the vertices by y-coordinate ascending (y0 < y1 < y2) */
-    if (p0.y > p1.y) { swapTexturePoint(&p0, &p1); }
-    if (p1.y > p2.y) { swapTexturePoint(&p1, &p2); }
-    if (p0.y > p1.y) { swapTexturePoint(&p0, &p1); }
+void drawFilledTriangleClipped(Point4 p0, Point4 p1, Point4 p2, uint32_t color, ClipRect clip, raster_stats_t* stats) {
+    rasterizeFilledTriangle(p0, p1, p2, color, clip, stats, false);
+}
 
-    /* Flip the V component to account for inverted UV-Coordinates (V grows downwards) */
-    p0.v = 1.0 - p0.v;
-    p1.v = 1.0 - p1.v;
-    p2.v = 1.0 - p2.v;
+void drawOverdrawTriangleClipped(Point4 p0, Point4 p1, Point4 p2, ClipRect clip, raster_stats_t* stats) {
+    rasterizeFilledTriangle(p0, p1, p2, 0, clip, stats, true);
+}
 
-    /* Create vector points and texture coords after we sort the vertices */
-    vec4_t pointA = {p0.x, p0.y, p0.z, p0.w};
-    vec4_t pointB = {p1.x, p1.y, p1.z, p1.w};
-    vec4_t pointC = {p2.x, p2.y, p2.z, p2.w};
+void drawShadedTriangleClipped(Point4 p0, Point4 p1, Point4 p2, uint32_t color, const float shades[3], ClipRect clip, raster_stats_t* stats) {
+    raster_setup_t s;
 
-    tex2_t aUV = {p0.u, p0.v};
-    tex2_t bUV = {p1.u, p1.v};
-    tex2_t cUV = {p2.u, p2.v};
+    if (!setupTriangle(&s, p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, clip, stats)) { return; }
 
+    /* Classic Gouraud shading: the intensity is interpolated linearly in screen space (no divide per pixel) */
+    plane_t planes[2] = {
+        makePlane(&s, 1.0f / p0.w, 1.0f / p1.w, 1.0f / p2.w),
+        makePlane(&s, shades[0], shades[1], shades[2])
+    };
 
-    /**
-     * Render the upper part of the triangle (Flat-Bottom)
-     */
-    float invSlope1 = 0;
-    float invSlope2 = 0;
+    int64_t eRow[3] = { s.edgeRow[0], s.edgeRow[1], s.edgeRow[2] };
+    float valuesRow[2] = { planes[0].origin, planes[1].origin };
 
-    if (p1.y - p0.y != 0) { invSlope1 = (float)(p1.x - p0.x) / abs(p1.y - p0.y); }
-    if (p2.y - p0.y != 0) { invSlope2 = (float)(p2.x - p0.x) / abs(p2.y - p0.y); }
+    for (int y = s.minY; y <= s.maxY; y++) {
+        int64_t eBlock[3] = { eRow[0], eRow[1], eRow[2] };
+        float values[2] = { valuesRow[0], valuesRow[1] };
+        int index = (colorBufferPitch * y) + s.minX;
 
-    if (p1.y - p0.y != 0) {
-        for (int y = p0.y; y <= p1.y; y++) {
-            int xStart = p1.x + (y - p1.y) * invSlope1;
-            int xEnd = p0.x + (y - p0.y) * invSlope2;
+        for (int x = s.minX; x <= s.maxX; x += PIXEL_BLOCK_WIDTH, index += PIXEL_BLOCK_WIDTH) {
+            int lanes = (s.maxX - x + 1 < PIXEL_BLOCK_WIDTH) ? (s.maxX - x + 1) : PIXEL_BLOCK_WIDTH;
+            int e[3] = { saturateEdge(eBlock[0]), saturateEdge(eBlock[1]), saturateEdge(eBlock[2]) };
 
-            if (xEnd < xStart) { int_swap(&xStart, &xEnd); }
+            drawShadedBlock(&s, planes, index, lanes, e, values, color);
 
-            for (int x = xStart; x < xEnd; x++) {
-                Point pixelToDraw = {x, y};
-                drawTriangleTexel(pixelToDraw, texture, pointA, pointB, pointC, aUV, bUV, cUV);
+            for (int i = 0; i < 3; i++) {
+                eBlock[i] += s.edgeStepBlock[i];
             }
+            values[0] += planes[0].dxBlock;
+            values[1] += planes[1].dxBlock;
         }
+
+        for (int i = 0; i < 3; i++) {
+            eRow[i] += s.edgeStepY[i];
+        }
+        valuesRow[0] += planes[0].dy;
+        valuesRow[1] += planes[1].dy;
     }
+}
 
-    /**
-     * Render the bottom part of the triangle (Flat-Top)
-     */
-    invSlope1 = 0;
-    invSlope2 = 0;
+void drawTexturedTriangle(TexturePoint p0, TexturePoint p1, TexturePoint p2, const texture_t* texture) {
+    drawTexturedTriangleClipped(p0, p1, p2, texture, screenClipRect(), NULL);
+}
 
-    if (p2.y - p1.y != 0) { invSlope1 = (float)(p2.x - p1.x) / abs(p2.y - p1.y); }
-    if (p2.y - p0.y != 0) { invSlope2 = (float)(p2.x - p0.x) / abs(p2.y - p0.y); }
+void drawTexturedTriangleClipped(TexturePoint p0, TexturePoint p1, TexturePoint p2, const texture_t* texture, ClipRect clip, raster_stats_t* stats) {
+    raster_setup_t s;
 
-    if (p2.y - p1.y != 0) {
-        for (int y = p1.y; y <= p2.y; y++) {
-            int xStart = p1.x + (y - p1.y) * invSlope1;
-            int xEnd = p0.x + (y - p0.y) * invSlope2;
+    if (!setupTriangle(&s, p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, clip, stats)) { return; }
 
-            if (xEnd < xStart) { int_swap(&xStart, &xEnd); }
+    /* Flip the V component to account for inverted UV-Coordinates (V grows downwards) */
+    p0.v = 1.0 - p0.v;
+    p1.v = 1.0 - p1.v;
+    p2.v = 1.0 - p2.v;
+
+    /* 1/w, U/w and V/w are linear in screen space, so they can be stepped like the edge functions */
+    plane_t planes[3] = {
+        makePlane(&s, 1.0f / p0.w, 1.0f / p1.w, 1.0f / p2.w),
+        makePlane(&s, p0.u / p0.w, p1.u / p1.w, p2.u / p2.w),
+        makePlane(&s, p0.v / p0.w, p1.v / p1.w, p2.v / p2.w)
+    };
+
+    int64_t eRow[3] = { s.edgeRow[0], s.edgeRow[1], s.edgeRow[2] };
+    float valuesRow[3] = { planes[0].origin, planes[1].origin, planes[2].origin };
+
+    for (int y = s.minY; y <= s.maxY; y++) {
+        int64_t eBlock[3] = { eRow[0], eRow[1], eRow[2] };
+        float values[3] = { valuesRow[0], valuesRow[1], valuesRow[2] };
+        int index = (colorBufferPitch * y) + s.minX;
+        const texture_level_t* level = NULL;
 
-            for (int x = xStart; x < xEnd; x++) {
-                Point pixelToDraw = {x, y};
-                drawTriangleTexel(pixelToDraw, texture, pointA, pointB, pointC, aUV, bUV, cUV);
+        for (int x = s.minX; x <= s.maxX; x += PIXEL_BLOCK_WIDTH, index += PIXEL_BLOCK_WIDTH) {
+            int lanes = (s.maxX - x + 1 < PIXEL_BLOCK_WIDTH) ? (s.maxX - x + 1) : PIXEL_BLOCK_WIDTH;
+            int e[3] = { saturateEdge(eBlock[0]), saturateEdge(eBlock[1]), saturateEdge(eBlock[2]) };
+
+            drawTexturedBlock(&s, planes, index, lanes, e, values, texture, &level);
+
+            for (int i = 0; i < 3; i++) {
+                eBlock[i] += s.edgeStepBlock[i];
+                values[i] += planes[i].dxBlock;
             }
         }
-    }
 
-}
\ No newline at end of file
+        for (int i = 0; i < 3; i++) {
+            eRow[i] += s.edgeStepY[i];
+            valuesRow[i] += planes[i].dy;
+        }
+    }
+}
@@ -30,6 +30,7 @@ freely, subject to the following restrictions:
 #include <limits.h>
 
 #include "upng.h"
+#include "simd.h"
 
 #define MAKE_BYTE(b) ((b) & 0xFF)
 #define MAKE_DWORD(a,b,c,d) ((MAKE_BYTE(a) << 24) | (MAKE_BYTE(b) << 16) | (MAKE_BYTE(c) << 8) | MAKE_BYTE(d))
@@ -47,14 +48,18 @@ freely, subject to the following restrictions:
 #define NUM_CODE_LENGTH_CODES 19	/*the code length codes. 0-15: code lengths, 16: copy previous 3-6 times, 17: 3-10 zeros, 18: 11-138 zeros */
 #define MAX_SYMBOLS 288 /* largest number of symbols used by any tree type */
 
-#define DEFLATE_CODE_BITLEN 15
-#define DISTANCE_BITLEN 15
-#define CODE_LENGTH_BITLEN 7
 #define MAX_BIT_LENGTH 15 /* largest bitlen used by any tree type */
 
-#define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
-#define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-#define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
+/* number of input bits resolved by the first level of the decoding tables, longer codes continue in a second level */
+#define DEFLATE_CODE_ROOT_BITS 9
+#define DISTANCE_ROOT_BITS 6
+#define CODE_LENGTH_ROOT_BITS 7
+#define MAX_ROOT_BITS 9
+
+/* entries of the tables: the first level plus the second levels of the largest possible codes (zlib's "enough" bounds) */
+#define DEFLATE_CODE_TABLE_SIZE 852
+#define DISTANCE_TABLE_SIZE 592
+#define CODE_LENGTH_TABLE_SIZE (1 << CODE_LENGTH_ROOT_BITS)
 
 #define SET_ERROR(upng,code) do { (upng)->error = (code); (upng)->error_line = __LINE__; } while (0)
 
@@ -100,11 +105,27 @@ struct upng_t {
 	upng_source		source;
 };
 
-typedef struct huffman_tree {
-	unsigned* tree2d;
-	unsigned maxbitlen;	/*maximum number of bits a single code can get */
-	unsigned numcodes;	/*number of symbols in the alphabet = number of codes */
-} huffman_tree;
+/* entry of a Huffman decoding table, indexed by the next input bits (the first bit read is the lowest index bit) */
+typedef struct huffman_entry {
+	unsigned short symbol;	/*decoded symbol, or index of the second level table when sub_bits is not 0 */
+	unsigned char bits;	/*number of bits of the code within this level, 0 for bit patterns that are not a code */
+	unsigned char sub_bits;	/*number of index bits of the second level table */
+} huffman_entry;
+
+typedef struct huffman_table {
+	huffman_entry* entries;
+	unsigned size;	/*number of entries available for the two levels */
+	unsigned root_bits;	/*number of index bits of the first level */
+} huffman_table;
+
+/* LSB first bit reader, loading the input a whole word at a time */
+typedef struct bit_reader {
+	const unsigned char* in;
+	unsigned long size;	/*size of the input in bytes */
+	unsigned long pos;	/*next byte of the input to load */
+	unsigned long long buffer;	/*bits loaded but not consumed yet, the next bit is the lowest one */
+	unsigned count;	/*number of bits in the buffer */
+} bit_reader;
 
 static const unsigned LENGTH_BASE[29] = {	/*the base lengths represented by codes 257-285 */
 	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
@@ -129,204 +150,232 @@ static const unsigned DISTANCE_EXTRA[30] = {	/*the extra bits of backwards dista
 static const unsigned CLCL[NUM_CODE_LENGTH_CODES]	/*the order in which "code length alphabet code lengths" are stored, out of this the huffman tree of the dynamic huffman tree lengths is generated */
 = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
 
-static const unsigned FIXED_DEFLATE_CODE_TREE[NUM_DEFLATE_CODE_SYMBOLS * 2] = {
-	289, 370, 290, 307, 546, 291, 561, 292, 293, 300, 294, 297, 295, 296, 0, 1,
-	2, 3, 298, 299, 4, 5, 6, 7, 301, 304, 302, 303, 8, 9, 10, 11, 305, 306, 12,
-	13, 14, 15, 308, 339, 309, 324, 310, 317, 311, 314, 312, 313, 16, 17, 18,
-	19, 315, 316, 20, 21, 22, 23, 318, 321, 319, 320, 24, 25, 26, 27, 322, 323,
-	28, 29, 30, 31, 325, 332, 326, 329, 327, 328, 32, 33, 34, 35, 330, 331, 36,
-	37, 38, 39, 333, 336, 334, 335, 40, 41, 42, 43, 337, 338, 44, 45, 46, 47,
-	340, 355, 341, 348, 342, 345, 343, 344, 48, 49, 50, 51, 346, 347, 52, 53,
-	54, 55, 349, 352, 350, 351, 56, 57, 58, 59, 353, 354, 60, 61, 62, 63, 356,
-	363, 357, 360, 358, 359, 64, 65, 66, 67, 361, 362, 68, 69, 70, 71, 364,
-	367, 365, 366, 72, 73, 74, 75, 368, 369, 76, 77, 78, 79, 371, 434, 372,
-	403, 373, 388, 374, 381, 375, 378, 376, 377, 80, 81, 82, 83, 379, 380, 84,
-	85, 86, 87, 382, 385, 383, 384, 88, 89, 90, 91, 386, 387, 92, 93, 94, 95,
-	389, 396, 390, 393, 391, 392, 96, 97, 98, 99, 394, 395, 100, 101, 102, 103,
-	397, 400, 398, 399, 104, 105, 106, 107, 401, 402, 108, 109, 110, 111, 404,
-	419, 405, 412, 406, 409, 407, 408, 112, 113, 114, 115, 410, 411, 116, 117,
-	118, 119, 413, 416, 414, 415, 120, 121, 122, 123, 417, 418, 124, 125, 126,
-	127, 420, 427, 421, 424, 422, 423, 128, 129, 130, 131, 425, 426, 132, 133,
-	134, 135, 428, 431, 429, 430, 136, 137, 138, 139, 432, 433, 140, 141, 142,
-	143, 435, 483, 436, 452, 568, 437, 438, 445, 439, 442, 440, 441, 144, 145,
-	146, 147, 443, 444, 148, 149, 150, 151, 446, 449, 447, 448, 152, 153, 154,
-	155, 450, 451, 156, 157, 158, 159, 453, 468, 454, 461, 455, 458, 456, 457,
-	160, 161, 162, 163, 459, 460, 164, 165, 166, 167, 462, 465, 463, 464, 168,
-	169, 170, 171, 466, 467, 172, 173, 174, 175, 469, 476, 470, 473, 471, 472,
-	176, 177, 178, 179, 474, 475, 180, 181, 182, 183, 477, 480, 478, 479, 184,
-	185, 186, 187, 481, 482, 188, 189, 190, 191, 484, 515, 485, 500, 486, 493,
-	487, 490, 488, 489, 192, 193, 194, 195, 491, 492, 196, 197, 198, 199, 494,
-	497, 495, 496, 200, 201, 202, 203, 498, 499, 204, 205, 206, 207, 501, 508,
-	502, 505, 503, 504, 208, 209, 210, 211, 506, 507, 212, 213, 214, 215, 509,
-	512, 510, 511, 216, 217, 218, 219, 513, 514, 220, 221, 222, 223, 516, 531,
-	517, 524, 518, 521, 519, 520, 224, 225, 226, 227, 522, 523, 228, 229, 230,
-	231, 525, 528, 526, 527, 232, 233, 234, 235, 529, 530, 236, 237, 238, 239,
-	532, 539, 533, 536, 534, 535, 240, 241, 242, 243, 537, 538, 244, 245, 246,
-	247, 540, 543, 541, 542, 248, 249, 250, 251, 544, 545, 252, 253, 254, 255,
-	547, 554, 548, 551, 549, 550, 256, 257, 258, 259, 552, 553, 260, 261, 262,
-	263, 555, 558, 556, 557, 264, 265, 266, 267, 559, 560, 268, 269, 270, 271,
-	562, 565, 563, 564, 272, 273, 274, 275, 566, 567, 276, 277, 278, 279, 569,
-	572, 570, 571, 280, 281, 282, 283, 573, 574, 284, 285, 286, 287, 0, 0
-};
+static void bit_reader_init(bit_reader* reader, const unsigned char* in, unsigned long size, unsigned long pos)
+{
+	reader->in = in;
+	reader->size = size;
+	reader->pos = pos;
+	reader->buffer = 0;
+	reader->count = 0;
+}
 
-static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
-	33, 48, 34, 41, 35, 38, 36, 37, 0, 1, 2, 3, 39, 40, 4, 5, 6, 7, 42, 45, 43,
-	44, 8, 9, 10, 11, 46, 47, 12, 13, 14, 15, 49, 56, 50, 53, 51, 52, 16, 17,
-	18, 19, 54, 55, 20, 21, 22, 23, 57, 60, 58, 59, 24, 25, 26, 27, 61, 62, 28,
-	29, 30, 31, 0, 0
-};
+/* top the buffer up to at least 56 bits; past the end of the input it is filled with zero bits, see bit_reader_overrun */
+static void bit_reader_refill(bit_reader* reader)
+{
+	if (reader->pos + 8 <= reader->size) {
+		/* load 8 bytes at once but only count the whole bytes that fit: the other bits are loaded again by the next refill */
+		const unsigned char* p = reader->in + reader->pos;
+		unsigned long long word = (unsigned long long)p[0] | ((unsigned long long)p[1] << 8) | ((unsigned long long)p[2] << 16) | ((unsigned long long)p[3] << 24)
+			| ((unsigned long long)p[4] << 32) | ((unsigned long long)p[5] << 40) | ((unsigned long long)p[6] << 48) | ((unsigned long long)p[7] << 56);
+
+		reader->buffer |= word << reader->count;
+		reader->pos += (63 - reader->count) >> 3;
+		reader->count |= 56;
+	} else {
+		while (reader->count <= 56) {
+			unsigned long long byte = (reader->pos < reader->size) ? reader->in[reader->pos] : 0;
+
+			reader->buffer |= byte << reader->count;
+			reader->pos++;
+			reader->count += 8;
+		}
+	}
+}
+
+/* number of bits consumed from the start of the input */
+static unsigned long bit_reader_position(const bit_reader* reader)
+{
+	return reader->pos * 8 - reader->count;
+}
+
+/* true when more bits were consumed than the input has */
+static int bit_reader_overrun(const bit_reader* reader)
+{
+	return bit_reader_position(reader) > reader->size * 8;
+}
+
+/* the buffer must hold nbits bits */
+static unsigned peek_bits(const bit_reader* reader, unsigned nbits)
+{
+	return (unsigned)(reader->buffer & ((1ULL << nbits) - 1));
+}
 
-static unsigned char read_bit(unsigned long *bitpointer, const unsigned char *bitstream)
+static void consume_bits(bit_reader* reader, unsigned nbits)
 {
-	unsigned char result = (unsigned char)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) & 1);
-	(*bitpointer)++;
+	reader->buffer >>= nbits;
+	reader->count -= nbits;
+}
+
+static unsigned read_bits(bit_reader* reader, unsigned nbits)
+{
+	unsigned result;
+
+	if (reader->count < nbits) {
+		bit_reader_refill(reader);
+	}
+
+	result = peek_bits(reader, nbits);
+	consume_bits(reader, nbits);
 	return result;
 }
 
-static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream, unsigned long nbits)
+static unsigned reverse_bits(unsigned code, unsigned nbits)
 {
 	unsigned result = 0, i;
-	for (i = 0; i < nbits; i++)
-		result |= ((unsigned)read_bit(bitpointer, bitstream)) << i;
+	for (i = 0; i < nbits; i++) {
+		result = (result << 1) | ((code >> i) & 1);
+	}
 	return result;
 }
 
-/* the buffer must be numcodes*2 in size! */
-static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned numcodes, unsigned maxbitlen)
+static void huffman_table_init(huffman_table* table, huffman_entry* entries, unsigned size, unsigned root_bits)
 {
-	tree->tree2d = buffer;
-
-	tree->numcodes = numcodes;
-	tree->maxbitlen = maxbitlen;
+	table->entries = entries;
+	table->size = size;
+	table->root_bits = root_bits;
 }
 
-/*given the code lengths (as stored in the PNG file), generate the tree as defined by Deflate. maxbitlen is the maximum bits that a code in the tree can have. return value is error.*/
-static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const unsigned *bitlen)
+/*given the code lengths (as stored in the PNG file), generate the decoding table of the canonical codes as defined by Deflate.
+  Deflate sends the codes most significant bit first, so a code of n bits fills every first level entry whose n low index bits are the code reversed.
+  Codes longer than root_bits continue in a second level table per first level entry, as large as the longest code sharing that entry. */
+static void huffman_table_create_lengths(upng_t* upng, huffman_table* table, const unsigned *bitlen, unsigned numcodes)
 {
-	unsigned tree1d[MAX_SYMBOLS];
-	unsigned blcount[MAX_BIT_LENGTH];
-	unsigned nextcode[MAX_BIT_LENGTH+1];
+	unsigned short codes[MAX_SYMBOLS];
+	unsigned char sub_bits[1 << MAX_ROOT_BITS];
+	unsigned blcount[MAX_BIT_LENGTH + 1];
+	unsigned nextcode[MAX_BIT_LENGTH + 1];
+	unsigned root_bits = table->root_bits;
+	unsigned root_size = 1u << root_bits;
+	unsigned used = root_size;
 	unsigned bits, n, i;
-	unsigned nodefilled = 0;	/*up to which node it is filled */
-	unsigned treepos = 0;	/*position in the tree (1 of the numcodes columns) */
+	long left = 1;
 
 	/* initialize local vectors */
 	memset(blcount, 0, sizeof(blcount));
 	memset(nextcode, 0, sizeof(nextcode));
+	memset(sub_bits, 0, sizeof(sub_bits));
 
 	/*step 1: count number of instances of each code length */
-	for (bits = 0; bits < tree->numcodes; bits++) {
-		blcount[bitlen[bits]]++;
+	for (n = 0; n < numcodes; n++) {
+		blcount[bitlen[n]]++;
+	}
+	blcount[0] = 0;
+
+	/* check if oversubscribed (incomplete codes are accepted, their unused bit patterns are decoding errors) */
+	for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
+		left = (left << 1) - blcount[bits];
+		if (left < 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
 	}
 
 	/*step 2: generate the nextcode values */
-	for (bits = 1; bits <= tree->maxbitlen; bits++) {
+	for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
 		nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
 	}
 
-	/*step 3: generate all the codes */
-	for (n = 0; n < tree->numcodes; n++) {
+	/*step 3: generate all the codes, in reading order, and the size of the second level tables */
+	for (n = 0; n < numcodes; n++) {
 		if (bitlen[n] != 0) {
-			tree1d[n] = nextcode[bitlen[n]]++;
+			codes[n] = (unsigned short)reverse_bits(nextcode[bitlen[n]]++, bitlen[n]);
+
+			if (bitlen[n] > root_bits && bitlen[n] - root_bits > sub_bits[codes[n] & (root_size - 1)]) {
+				sub_bits[codes[n] & (root_size - 1)] = (unsigned char)(bitlen[n] - root_bits);
+			}
 		}
 	}
 
-	/*convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means uninited, a value >= numcodes is an address to another bit, a value < numcodes is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as many columns as codes - 1
-	   a good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes. Here, the internal nodes are stored (what their 0 and 1 option point to). There is only memory for such good tree currently, if there are more nodes (due to too long length codes), error 55 will happen */
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		tree->tree2d[n] = 32767;	/*32767 here means the tree2d isn't filled there yet */
-	}
+	/*step 4: lay out the tables, every entry starts as "not a code" */
+	memset(table->entries, 0, sizeof(huffman_entry) * root_size);
+
+	for (i = 0; i < root_size; i++) {
+		if (sub_bits[i] != 0) {
+			unsigned sub_size = 1u << sub_bits[i];
 
-	for (n = 0; n < tree->numcodes; n++) {	/*the codes */
-		for (i = 0; i < bitlen[n]; i++) {	/*the bits for this code */
-			unsigned char bit = (unsigned char)((tree1d[n] >> (bitlen[n] - i - 1)) & 1);
-			/* check if oversubscribed */
-			if (treepos > tree->numcodes - 2) {
+			if (used + sub_size > table->size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
-			if (tree->tree2d[2 * treepos + bit] == 32767) {	/*not yet filled in */
-				if (i + 1 == bitlen[n]) {	/*last bit */
-					tree->tree2d[2 * treepos + bit] = n;	/*put the current code in it */
-					treepos = 0;
-				} else {	/*put address of the next step in here, first that address has to be found of course (it's just nodefilled + 1)... */
-					nodefilled++;
-					tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;	/*addresses encoded with numcodes added to it */
-					treepos = nodefilled;
-				}
-			} else {
-				treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
-			}
+			table->entries[i].symbol = (unsigned short)used;
+			table->entries[i].bits = (unsigned char)root_bits;
+			table->entries[i].sub_bits = sub_bits[i];
+			memset(&table->entries[used], 0, sizeof(huffman_entry) * sub_size);
+			used += sub_size;
 		}
 	}
 
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		if (tree->tree2d[n] == 32767) {
-			tree->tree2d[n] = 0;	/*remove possible remaining 32767's */
+	/*step 5: fill in every entry whose low index bits are a code */
+	for (n = 0; n < numcodes; n++) {
+		if (bitlen[n] == 0) {
+			continue;
+		}
+
+		if (bitlen[n] <= root_bits) {
+			for (i = codes[n]; i < root_size; i += 1u << bitlen[n]) {
+				table->entries[i].symbol = (unsigned short)n;
+				table->entries[i].bits = (unsigned char)bitlen[n];
+			}
+		} else {
+			const huffman_entry* link = &table->entries[codes[n] & (root_size - 1)];
+			unsigned sub_length = bitlen[n] - root_bits;
+
+			for (i = codes[n] >> root_bits; i < (1u << link->sub_bits); i += 1u << sub_length) {
+				table->entries[link->symbol + i].symbol = (unsigned short)n;
+				table->entries[link->symbol + i].bits = (unsigned char)sub_length;
+			}
 		}
 	}
 }
 
-static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, unsigned long *bp, const huffman_tree* codetree, unsigned long inlength)
+/* the buffer must hold at least MAX_BIT_LENGTH bits */
+static unsigned huffman_decode_symbol(upng_t *upng, bit_reader* reader, const huffman_table* table)
 {
-	unsigned treepos = 0, ct;
-	unsigned char bit;
-	for (;;) {
-		/* error: end of input memory reached without endcode */
-		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+	huffman_entry entry = table->entries[peek_bits(reader, table->root_bits)];
 
-		bit = read_bit(bp, in);
-
-		ct = codetree->tree2d[(treepos << 1) | bit];
-		if (ct < codetree->numcodes) {
-			return ct;
-		}
+	if (entry.sub_bits != 0) {
+		consume_bits(reader, table->root_bits);
+		entry = table->entries[entry.symbol + peek_bits(reader, entry.sub_bits)];
+	}
 
-		treepos = ct - codetree->numcodes;
-		if (treepos >= codetree->numcodes) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+	/* error: a bit pattern that is not a code of an incomplete tree */
+	if (entry.bits == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return 0;
 	}
+
+	consume_bits(reader, entry.bits);
+	return entry.symbol;
 }
 
 /* get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char *in, unsigned long *bp, unsigned long inlength)
+static void get_tree_inflate_dynamic(upng_t* upng, huffman_table* codetable, huffman_table* codetableD, bit_reader* reader)
 {
+	huffman_entry codelengthcode_entries[CODE_LENGTH_TABLE_SIZE];
+	huffman_table codelengthcodetable;
 	unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
-	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
-	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS + NUM_DISTANCE_SYMBOLS];	/*the lengths of the lit/len codes, followed by the ones of the dist codes */
 	unsigned n, hlit, hdist, hclen, i;
 
 	/*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated */
-	/*C-code note: use no "return" between ctor and dtor of an uivector! */
-	if ((*bp) >> 3 >= inlength - 2) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return;
-	}
-
-	/* clear bitlen arrays */
 	memset(bitlen, 0, sizeof(bitlen));
-	memset(bitlenD, 0, sizeof(bitlenD));
 
-	/*the bit pointer is or will go past the memory */
-	hlit = read_bits(bp, in, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
-	hdist = read_bits(bp, in, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
-	hclen = read_bits(bp, in, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
+	bit_reader_refill(reader);
+	hlit = read_bits(reader, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
+	hdist = read_bits(reader, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
+	hclen = read_bits(reader, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
 
 	for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
 		if (i < hclen) {
-			codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
+			codelengthcode[CLCL[i]] = read_bits(reader, 3);
 		} else {
 			codelengthcode[CLCL[i]] = 0;	/*if not, it must stay 0 */
 		}
 	}
 
-	huffman_tree_create_lengths(upng, codelengthcodetree, codelengthcode);
+	huffman_table_init(&codelengthcodetable, codelengthcode_entries, CODE_LENGTH_TABLE_SIZE, CODE_LENGTH_ROOT_BITS);
+	huffman_table_create_lengths(upng, &codelengthcodetable, codelengthcode, NUM_CODE_LENGTH_CODES);
 
 	/* bail now if we encountered an error earlier */
 	if (upng->error != UPNG_EOK) {
@@ -336,154 +385,146 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	/*now we can use this tree to read the lengths for the tree that this function will return */
 	i = 0;
 	while (i < hlit + hdist) {	/*i is the current symbol we're reading in the part that contains the code lengths of lit/len codes and dist codes */
-		unsigned code = huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+		unsigned code, replength, value;
+
+		/* a code length code and its repeat bits are at most 14 bits */
+		bit_reader_refill(reader);
+		code = huffman_decode_symbol(upng, reader, &codelengthcodetable);
 		if (upng->error != UPNG_EOK) {
-			break;
+			return;
 		}
 
 		if (code <= 15) {	/*a length code */
-			if (i < hlit) {
-				bitlen[i] = code;
-			} else {
-				bitlenD[i - hlit] = code;
-			}
+			bitlen[i < hlit ? i : NUM_DEFLATE_CODE_SYMBOLS + i - hlit] = code;
 			i++;
-		} else if (code == 16) {	/*repeat previous */
-			unsigned replength = 3;	/*read in the 2 bits that indicate repeat length (3-6) */
-			unsigned value;	/*set value to the previous code */
+			continue;
+		}
 
-			if ((*bp) >> 3 >= inlength) {
+		if (code == 16) {	/*repeat previous 3-6 times */
+			/* error: there is no previous length */
+			if (i == 0) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 2);
-
-			if ((i - 1) < hlit) {
-				value = bitlen[i - 1];
-			} else {
-				value = bitlenD[i - hlit - 1];
-			}
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-
-				if (i < hlit) {
-					bitlen[i] = value;
-				} else {
-					bitlenD[i - hlit] = value;
-				}
-				i++;
+				return;
 			}
+			value = bitlen[i - 1 < hlit ? i - 1 : NUM_DEFLATE_CODE_SYMBOLS + i - 1 - hlit];
+			replength = 3 + read_bits(reader, 2);
 		} else if (code == 17) {	/*repeat "0" 3-10 times */
-			unsigned replength = 3;	/*read in the bits that indicate repeat length */
-			if ((*bp) >> 3 >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
-
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 3);
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* error: i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-
-				if (i < hlit) {
-					bitlen[i] = 0;
-				} else {
-					bitlenD[i - hlit] = 0;
-				}
-				i++;
-			}
-		} else if (code == 18) {	/*repeat "0" 11-138 times */
-			unsigned replength = 11;	/*read in the bits that indicate repeat length */
-			/* error, bit pointer jumps past memory */
-			if ((*bp) >> 3 >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
+			value = 0;
+			replength = 3 + read_bits(reader, 3);
+		} else {	/*repeat "0" 11-138 times (18 is the largest code length code) */
+			value = 0;
+			replength = 11 + read_bits(reader, 7);
+		}
 
-			replength += read_bits(bp, in, 7);
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-				if (i < hlit)
-					bitlen[i] = 0;
-				else
-					bitlenD[i - hlit] = 0;
-				i++;
-			}
-		} else {
-			/* somehow an unexisting code appeared. This can never happen. */
+		/* error: i would be larger than the amount of codes */
+		if (i + replength > hlit + hdist) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			break;
+			return;
+		}
+
+		for (n = 0; n < replength; n++, i++) {
+			bitlen[i < hlit ? i : NUM_DEFLATE_CODE_SYMBOLS + i - hlit] = value;
 		}
 	}
 
-	if (upng->error == UPNG_EOK && bitlen[256] == 0) {
+	/* error: the lengths went past the end of the input */
+	if (bit_reader_overrun(reader)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
 	}
 
 	/*the length of the end code 256 must be larger than 0 */
-	/*now we've finally got hlit and hdist, so generate the code trees, and the function is done */
+	if (bitlen[256] == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	/*now we've finally got hlit and hdist, so generate the code tables, and the function is done */
+	huffman_table_create_lengths(upng, codetable, bitlen, NUM_DEFLATE_CODE_SYMBOLS);
 	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetree, bitlen);
+		huffman_table_create_lengths(upng, codetableD, bitlen + NUM_DEFLATE_CODE_SYMBOLS, NUM_DISTANCE_SYMBOLS);
+	}
+}
+
+/* get the fixed trees of deflate, given by their code lengths */
+static void get_tree_inflate_fixed(upng_t* upng, huffman_table* codetable, huffman_table* codetableD)
+{
+	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
+	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+	unsigned i;
+
+	for (i = 0; i < NUM_DEFLATE_CODE_SYMBOLS; i++) {
+		bitlen[i] = (i <= 143) ? 8 : (i <= 255) ? 9 : (i <= 279) ? 7 : 8;
+	}
+
+	for (i = 0; i < NUM_DISTANCE_SYMBOLS; i++) {
+		bitlenD[i] = 5;
 	}
+
+	huffman_table_create_lengths(upng, codetable, bitlen, NUM_DEFLATE_CODE_SYMBOLS);
 	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetreeD, bitlenD);
+		huffman_table_create_lengths(upng, codetableD, bitlenD, NUM_DISTANCE_SYMBOLS);
+	}
+}
+
+/* copy a match of length bytes from distance bytes back, the output has room for it */
+static void copy_match(unsigned char* out, unsigned long pos, unsigned long outsize, unsigned long distance, unsigned long length)
+{
+	unsigned char* dest = out + pos;
+	const unsigned char* source = dest - distance;
+
+	if (distance >= 8 && pos + length + 8 <= outsize) {
+		/* 8 bytes at a time, the last copy may write past the match: the distance keeps every copy reading bytes already written */
+		unsigned char* end = dest + length;
+
+		do {
+			memcpy(dest, source, 8);
+			dest += 8;
+			source += 8;
+		} while (dest < end);
+	} else if (distance == 1) {
+		memset(dest, *source, length);
+	} else {
+		while (length-- > 0) {
+			*dest++ = *source++;
+		}
 	}
 }
 
 /*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength, unsigned btype)
+static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, bit_reader* reader, unsigned long *pos, unsigned btype)
 {
-	unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
-	unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
-	unsigned done = 0;
+	huffman_entry codetable_entries[DEFLATE_CODE_TABLE_SIZE];
+	huffman_entry codetableD_entries[DISTANCE_TABLE_SIZE];
+
+	huffman_table codetable;
+	huffman_table codetableD;
 
-	huffman_tree codetree;
-	huffman_tree codetreeD;
+	huffman_table_init(&codetable, codetable_entries, DEFLATE_CODE_TABLE_SIZE, DEFLATE_CODE_ROOT_BITS);
+	huffman_table_init(&codetableD, codetableD_entries, DISTANCE_TABLE_SIZE, DISTANCE_ROOT_BITS);
 
 	if (btype == 1) {
-		/* fixed trees */
-		huffman_tree_init(&codetree, (unsigned*)FIXED_DEFLATE_CODE_TREE, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, (unsigned*)FIXED_DISTANCE_TREE, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-	} else if (btype == 2) {
-		/* dynamic trees */
-		unsigned codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
-		huffman_tree codelengthcodetree;
+		get_tree_inflate_fixed(upng, &codetable, &codetableD);
+	} else {
+		get_tree_inflate_dynamic(upng, &codetable, &codetableD, reader);
+	}
 
-		huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in, bp, inlength);
+	if (upng->error != UPNG_EOK) {
+		return;
 	}
 
-	while (done == 0) {
-		unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
+	for (;;) {
+		unsigned code;
+
+		/* one refill covers a whole length and distance pair: 15 + 5 + 15 + 13 bits */
+		bit_reader_refill(reader);
+
+		code = huffman_decode_symbol(upng, reader, &codetable);
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
 
-		if (code == 256) {
-			/* end code */
-			done = 1;
-		} else if (code <= 255) {
+		if (code <= 255) {
 			/* literal symbol */
 			if ((*pos) >= outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
@@ -492,24 +533,20 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 
 			/* store output */
 			out[(*pos)++] = (unsigned char)(code);
-		} else if (code >= FIRST_LENGTH_CODE_INDEX && code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
-			/* part 1: get length base */
+		} else if (code == 256) {
+			/* end code */
+			break;
+		} else if (code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
+			/* part 1: get length base, plus the value of its extra bits */
 			unsigned long length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
+			unsigned numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
 			unsigned codeD, distance, numextrabitsD;
-			unsigned long start, forward, backward, numextrabits;
 
-			/* part 2: get extra bits and add the value of that to length */
-			numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
-
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
-			length += read_bits(bp, in, numextrabits);
+			length += peek_bits(reader, numextrabits);
+			consume_bits(reader, numextrabits);
 
-			/*part 3: get distance code */
-			codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+			/*part 2: get distance code */
+			codeD = huffman_decode_symbol(upng, reader, &codetableD);
 			if (upng->error != UPNG_EOK) {
 				return;
 			}
@@ -520,53 +557,52 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 				return;
 			}
 
+			/*part 3: get distance base, plus the value of its extra bits */
 			distance = DISTANCE_BASE[codeD];
-
-			/*part 4: get extra bits from distance */
 			numextrabitsD = DISTANCE_EXTRA[codeD];
 
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
+			distance += peek_bits(reader, numextrabitsD);
+			consume_bits(reader, numextrabitsD);
+
+			/* error: the match starts before the output */
+			if (distance > (*pos)) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
-			distance += read_bits(bp, in, numextrabitsD);
-
-			/*part 5: fill in all the out[n] values based on the length and dist */
-			start = (*pos);
-			backward = start - distance;
-
-			if ((*pos) + length >= outsize) {
+			if ((*pos) + length > outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
-			for (forward = 0; forward < length; forward++) {
-				out[(*pos)++] = out[backward];
-				backward++;
+			/*part 4: fill in all the out[n] values based on the length and dist */
+			copy_match(out, *pos, outsize, distance, length);
+			(*pos) += length;
+		} else {
+			/* invalid length code (286-287 are never used) */
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
 
-				if (backward >= start) {
-					backward = start - distance;
-				}
-			}
+		/* error: end of input memory reached without endcode */
+		if (reader->pos > reader->size && bit_reader_overrun(reader)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
 		}
 	}
 }
 
-static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength)
+static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, bit_reader* reader, unsigned long *pos)
 {
+	const unsigned char* in = reader->in;
 	unsigned long p;
-	unsigned len, nlen, n;
+	unsigned len, nlen;
 
 	/* go to first boundary of byte */
-	while (((*bp) & 0x7) != 0) {
-		(*bp)++;
-	}
-	p = (*bp) / 8;		/*byte position */
+	p = (bit_reader_position(reader) + 7) / 8;	/*byte position */
 
 	/* read len (2 bytes) and nlen (2 bytes) */
-	if (p >= inlength - 4) {
+	if (p + 4 > reader->size) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
@@ -582,53 +618,55 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
 		return;
 	}
 
-	if ((*pos) + len >= outsize) {
+	if ((*pos) + len > outsize) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
 	/* read the literal data: len bytes are now stored in the out buffer */
-	if (p + len > inlength) {
+	if (p + len > reader->size) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	for (n = 0; n < len; n++) {
-		out[(*pos)++] = in[p++];
-	}
+	memcpy(&out[*pos], &in[p], len);
+	(*pos) += len;
 
-	(*bp) = p * 8;
+	/* the next block starts on the byte after the data, the bits buffered past it are dropped */
+	bit_reader_init(reader, in, reader->size, p + len);
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
 static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long insize, unsigned long inpos)
 {
-	unsigned long bp = 0;	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
+	bit_reader reader;	/*bit reader of the "in" data, after the zlib header */
 	unsigned long pos = 0;	/*byte position in the out buffer */
 
 	unsigned done = 0;
 
+	bit_reader_init(&reader, &in[inpos], insize - inpos, 0);
+
 	while (done == 0) {
 		unsigned btype;
 
 		/* ensure next bit doesn't point past the end of the buffer */
-		if ((bp >> 3) >= insize) {
+		if (bit_reader_position(&reader) >= reader.size * 8) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
 
 		/* read block control bits */
-		done = read_bit(&bp, &in[inpos]);
-		btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
+		done = read_bits(&reader, 1);
+		btype = read_bits(&reader, 2);
 
 		/* process control type appropriateyly */
 		if (btype == 3) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		} else if (btype == 0) {
-			inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize);	/*no compression */
+			inflate_uncompressed(upng, out, outsize, &reader, &pos);	/*no compression */
 		} else {
-			inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize, btype);	/*compression, btype 01 or 10 */
+			inflate_huffman(upng, out, outsize, &reader, &pos, btype);	/*compression, btype 01 or 10 */
 		}
 
 		/* stop if an error has occured */
@@ -637,6 +675,11 @@ static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned lon
 		}
 	}
 
+	/* error: the data ends before the end of the image, the rest of out would stay uninitialized */
+	if (pos != outsize) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	}
+
 	return upng->error;
 }
 
@@ -688,6 +731,114 @@ static int paeth_predictor(int a, int b, int c)
 		return c;
 }
 
+#ifdef HAS_SSE2
+/* a 3 or 4 byte pixel in the low lanes of a register, 3 byte pixels never touch the next byte */
+static __m128i load_pixel(const unsigned char* p, unsigned long bytewidth)
+{
+	int value = p[0] | (p[1] << 8) | (p[2] << 16);
+	if (bytewidth == 4) {
+		value |= (int)((unsigned)p[3] << 24);
+	}
+	return _mm_cvtsi32_si128(value);
+}
+
+static void store_pixel(unsigned char* p, __m128i pixel, unsigned long bytewidth)
+{
+	unsigned value = (unsigned)_mm_cvtsi128_si32(pixel);
+	p[0] = (unsigned char)value;
+	p[1] = (unsigned char)(value >> 8);
+	p[2] = (unsigned char)(value >> 16);
+	if (bytewidth == 4) {
+		p[3] = (unsigned char)(value >> 24);
+	}
+}
+
+static __m128i select_epi16(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static __m128i abs_epi16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+/*
+   SSE2 versions of unfilter_scanline, same arguments; return 0 for the cases they don't handle.
+   Up is 16 bytes at a time for any pixel size. Sub, Average and Paeth depend on the pixel to the left, so they run one
+   3 or 4 byte pixel at a time with all its channels in one register (Paeth in 16-bit lanes).
+   Every pixel is loaded from scanline before it is stored to recon, so recon may still be scanline or overlap it from below.
+ */
+static int unfilter_scanline_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned long i;
+
+	if (filterType == 2 && precon) {
+		for (i = 0; i + 16 <= length; i += 16) {
+			__m128i sum = _mm_add_epi8(_mm_loadu_si128((const __m128i*)&scanline[i]), _mm_loadu_si128((const __m128i*)&precon[i]));
+			_mm_storeu_si128((__m128i*)&recon[i], sum);
+		}
+		for (; i < length; i++)
+			recon[i] = scanline[i] + precon[i];
+		return 1;
+	}
+
+	if (bytewidth != 3 && bytewidth != 4) {
+		return 0;
+	}
+
+	if (filterType == 1) {
+		__m128i a = zero;
+		for (i = 0; i < length; i += bytewidth) {
+			a = _mm_add_epi8(a, load_pixel(&scanline[i], bytewidth));
+			store_pixel(&recon[i], a, bytewidth);
+		}
+		return 1;
+	}
+
+	if (filterType == 3 && precon) {
+		const __m128i one = _mm_set1_epi8(1);
+		__m128i a = zero;
+		for (i = 0; i < length; i += bytewidth) {
+			__m128i b = load_pixel(&precon[i], bytewidth);
+			/* pavgb rounds up, (a + b) / 2 rounds down */
+			__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+
+			a = _mm_add_epi8(load_pixel(&scanline[i], bytewidth), average);
+			store_pixel(&recon[i], a, bytewidth);
+		}
+		return 1;
+	}
+
+	if (filterType == 4 && precon) {
+		const __m128i low_byte = _mm_set1_epi16(0xFF);
+		__m128i a = zero, c = zero;
+		for (i = 0; i < length; i += bytewidth) {
+			__m128i b = _mm_unpacklo_epi8(load_pixel(&precon[i], bytewidth), zero);
+			__m128i x = _mm_unpacklo_epi8(load_pixel(&scanline[i], bytewidth), zero);
+
+			/* the distances of p = a + b - c to a, b and c, and the first of a, b, c (in that order) with the smallest one */
+			__m128i pa = abs_epi16(_mm_sub_epi16(b, c));
+			__m128i pb = abs_epi16(_mm_sub_epi16(a, c));
+			__m128i pc = abs_epi16(_mm_sub_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, c)));
+			__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			__m128i nearest = select_epi16(_mm_cmpeq_epi16(smallest, pc), c, b);
+
+			nearest = select_epi16(_mm_cmpeq_epi16(smallest, pb), b, nearest);
+			nearest = select_epi16(_mm_cmpeq_epi16(smallest, pa), a, nearest);
+
+			a = _mm_and_si128(_mm_add_epi16(x, nearest), low_byte);
+			store_pixel(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+			c = b;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+#endif
+
 static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
 {
 	/*
@@ -695,14 +846,20 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	   unfilter a PNG image scanline by scanline. when the pixels are smaller than 1 byte, the filter works byte per byte (bytewidth = 1)
 	   precon is the previous unfiltered scanline, recon the result, scanline the current one
 	   the incoming scanlines do NOT include the filtertype byte, that one is given in the parameter filterType instead
-	   recon and scanline MAY be the same memory address! precon must be disjoint.
+	   recon and scanline MAY be the same memory address, or recon may start below scanline and overlap it! precon must be disjoint.
 	 */
 
 	unsigned long i;
+
+#ifdef HAS_SSE2
+	if (unfilter_scanline_sse2(recon, scanline, precon, bytewidth, filterType, length)) {
+		return;
+	}
+#endif
+
 	switch (filterType) {
 	case 0:
-		for (i = 0; i < length; i++)
-			recon[i] = scanline[i];
+		memmove(recon, scanline, length);
 		break;
 	case 1:
 		for (i = 0; i < bytewidth; i++)
@@ -757,7 +914,7 @@ static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in,
 	   this function unfilters a single image (e.g. without interlacing this is called once, with Adam7 it's called 7 times)
 	   out must have enough bytes allocated already, in must have the scanlines + 1 filtertype byte per scanline
 	   w and h are image dimensions or dimensions of reduced image, bpp is bpp per pixel
-	   in and out are allowed to be the same memory address!
+	   in and out are allowed to be the same memory address! (each scanline then moves down by the filter type bytes before it)
 	 */
 
 	unsigned y;
@@ -807,8 +964,8 @@ static void remove_padding_bits(unsigned char *out, const unsigned char *in, uns
 	}
 }
 
-/*out must be buffer big enough to contain full image, and in must contain the full decompressed data from the IDAT chunks*/
-static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned char *in, const upng_t* info_png)
+/*data must contain the full decompressed data from the IDAT chunks; it is unfiltered in place, the image ends up at the start of the buffer*/
+static void post_process_scanlines(upng_t* upng, unsigned char *data, const upng_t* info_png)
 {
 	unsigned bpp = upng_get_bpp(info_png);
 	unsigned w = info_png->width;
@@ -819,14 +976,119 @@ static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned ch
 		return;
 	}
 
+	unfilter(upng, data, data, w, h, bpp);
+	if (upng->error != UPNG_EOK) {
+		return;
+	}
+
 	if (bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8) {
-		unfilter(upng, in, in, w, h, bpp);
+		remove_padding_bits(data, data, w * bpp, ((w * bpp + 7) / 8) * 8, h);
+	}
+}
+
+/*value of channel number index of a scanline (counting the channels of every pixel), scaled to 8 bits: 16-bit channels keep their high byte, lower depths are scaled up*/
+static unsigned read_channel(const unsigned char *line, unsigned long index, unsigned depth)
+{
+	unsigned long bit;
+	unsigned value;
+
+	if (depth == 8) {
+		return line[index];
+	} else if (depth == 16) {
+		return line[index * 2];
+	}
+
+	bit = index * depth;
+	value = (line[bit >> 3] >> (8 - depth - (bit & 0x7))) & ((1u << depth) - 1);
+	return value * 255 / ((1u << depth) - 1);
+}
+
+static void write_pixel(unsigned char *out, unsigned r, unsigned g, unsigned b, unsigned a, upng_output_format format)
+{
+	if (format == UPNG_OUTPUT_ARGB8888) {
+		unsigned value = (a << 24) | (r << 16) | (g << 8) | b;
+		memcpy(out, &value, 4);
+	} else {
+		out[0] = (unsigned char)r;
+		out[1] = (unsigned char)g;
+		out[2] = (unsigned char)b;
+		out[3] = (unsigned char)a;
+	}
+}
+
+/*convert an unfiltered scanline of the image into output pixels*/
+static void convert_scanline(const upng_t* upng, unsigned char *out, const unsigned char *line, upng_output_format format)
+{
+	unsigned long width = upng->width;
+	unsigned depth = upng->color_depth;
+	unsigned long x = 0;
+
+	if (upng->color_type == UPNG_RGBA && depth == 8) {
+		if (format == UPNG_OUTPUT_RGBA8) {
+			memcpy(out, line, width * 4);
+			return;
+		}
+
+#ifdef HAS_SSE2
+		/* swap the R and B bytes of 4 pixels at a time, the words are little endian */
+		for (; x + 4 <= width; x += 4) {
+			__m128i pixels = _mm_loadu_si128((const __m128i*)&line[x * 4]);
+			__m128i alphaGreen = _mm_and_si128(pixels, _mm_set1_epi32((int)0xFF00FF00));
+			__m128i blueRed = _mm_and_si128(pixels, _mm_set1_epi32(0x00FF00FF));
+
+			blueRed = _mm_or_si128(_mm_slli_epi32(blueRed, 16), _mm_srli_epi32(blueRed, 16));
+			_mm_storeu_si128((__m128i*)&out[x * 4], _mm_or_si128(alphaGreen, blueRed));
+		}
+#endif
+	}
+
+	for (; x < width; x++) {
+		switch (upng->color_type) {
+		case UPNG_LUM: {
+			unsigned l = read_channel(line, x, depth);
+			write_pixel(&out[x * 4], l, l, l, 255, format);
+			break;
+		}
+		case UPNG_LUMA: {
+			unsigned l = read_channel(line, x * 2, depth);
+			write_pixel(&out[x * 4], l, l, l, read_channel(line, x * 2 + 1, depth), format);
+			break;
+		}
+		case UPNG_RGB:
+			write_pixel(&out[x * 4], read_channel(line, x * 3, depth), read_channel(line, x * 3 + 1, depth), read_channel(line, x * 3 + 2, depth), 255, format);
+			break;
+		case UPNG_RGBA:
+			write_pixel(&out[x * 4], read_channel(line, x * 4, depth), read_channel(line, x * 4 + 1, depth), read_channel(line, x * 4 + 2, depth), read_channel(line, x * 4 + 3, depth), format);
+			break;
+		}
+	}
+}
+
+/*unfilter every scanline in place (in data, after its filter type byte) and convert it into the output while it is still in cache*/
+static void unfilter_into(upng_t* upng, unsigned char *pixels, unsigned long stride, upng_output_format format, unsigned char *data)
+{
+	unsigned bpp = upng_get_bpp(upng);
+	unsigned y;
+	unsigned char *prevline = 0;
+
+	unsigned long bytewidth = (bpp + 7) / 8;
+	unsigned long linebytes = (upng->width * bpp + 7) / 8;
+
+	if (bpp == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	for (y = 0; y < upng->height; y++) {
+		unsigned char *line = &data[(1 + linebytes) * y + 1];
+
+		unfilter_scanline(upng, line, line, prevline, bytewidth, line[-1], linebytes);
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
-		remove_padding_bits(out, in, w * bpp, ((w * bpp + 7) / 8) * 8, h);
-	} else {
-		unfilter(upng, out, in, w, h, bpp);	/*we can immediatly filter into the out buffer, no other steps needed */
+
+		convert_scanline(upng, &pixels[stride * y], line, format);
+		prevline = line;
 	}
 }
 
@@ -960,30 +1222,33 @@ upng_error upng_header(upng_t* upng)
 	return upng->error;
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-upng_error upng_decode(upng_t* upng)
+/*inflate the IDAT data of the image into a new buffer holding the filtered scanlines, each one after its filter type byte.
+  return NULL if there is an error or nothing to decode*/
+static unsigned char* inflate_image_data(upng_t* upng)
 {
 	const unsigned char *chunk;
-	unsigned char* compressed;
+	const unsigned char *compressed;
 	unsigned char* inflated;
+	unsigned char* joined = NULL;	/*the data of the IDAT chunks put together, when there is more than one */
 	unsigned long compressed_size = 0, compressed_index = 0;
 	unsigned long inflated_size;
+	unsigned idat_count = 0;
 	upng_error error;
 
 	/* if we have an error state, bail now */
 	if (upng->error != UPNG_EOK) {
-		return upng->error;
+		return NULL;
 	}
 
 	/* parse the main header, if necessary */
 	upng_header(upng);
 	if (upng->error != UPNG_EOK) {
-		return upng->error;
+		return NULL;
 	}
 
 	/* if the state is not HEADER (meaning we are ready to decode the image), stop now */
 	if (upng->state != UPNG_HEADER) {
-		return upng->error;
+		return NULL;
 	}
 
 	/* release old result, if any */
@@ -995,109 +1260,124 @@ upng_error upng_decode(upng_t* upng)
 
 	/* first byte of the first chunk after the header */
 	chunk = upng->source.buffer + 33;
+	compressed = NULL;
 
 	/* scan through the chunks, finding the size of all IDAT chunks, and also
 	 * verify general well-formed-ness */
 	while (chunk < upng->source.buffer + upng->source.size) {
 		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
 
 		/* make sure chunk header is not larger than the total compressed */
 		if ((unsigned long)(chunk - upng->source.buffer + 12) > upng->source.size) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return NULL;
 		}
 
 		/* get length; sanity check it */
 		length = upng_chunk_length(chunk);
 		if (length > INT_MAX) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return NULL;
 		}
 
 		/* make sure chunk header+paylaod is not larger than the total compressed */
 		if ((unsigned long)(chunk - upng->source.buffer + length + 12) > upng->source.size) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return NULL;
 		}
 
-		/* get pointer to payload */
-		data = chunk + 8;
-
 		/* parse chunks */
 		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
+			compressed = chunk + 8;	/*the data in the chunk */
 			compressed_size += length;
+			idat_count++;
 		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
 			break;
 		} else if (upng_chunk_critical(chunk)) {
 			SET_ERROR(upng, UPNG_EUNSUPPORTED);
-			return upng->error;
+			return NULL;
 		}
 
 		chunk += upng_chunk_length(chunk) + 12;
 	}
 
-	/* allocate enough space for the (compressed and filtered) image data */
-	compressed = (unsigned char*)malloc(compressed_size);
-	if (compressed == NULL) {
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
-	}
-
-	/* scan through the chunks again, this time copying the values into
-	 * our compressed buffer.  there's no reason to validate anything a second time. */
-	chunk = upng->source.buffer + 33;
-	while (chunk < upng->source.buffer + upng->source.size) {
-		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
+	/* a single IDAT chunk is inflated where it is in the source, several ones are put together first */
+	if (idat_count > 1) {
+		/* allocate enough space for the (compressed and filtered) image data */
+		joined = (unsigned char*)malloc(compressed_size);
+		if (joined == NULL) {
+			SET_ERROR(upng, UPNG_ENOMEM);
+			return NULL;
+		}
 
-		length = upng_chunk_length(chunk);
-		data = chunk + 8;
+		/* scan through the chunks again, this time copying the values into
+		 * our compressed buffer.  there's no reason to validate anything a second time. */
+		chunk = upng->source.buffer + 33;
+		while (chunk < upng->source.buffer + upng->source.size) {
+			unsigned long length;
+			const unsigned char *data;	/*the data in the chunk */
+
+			length = upng_chunk_length(chunk);
+			data = chunk + 8;
+
+			/* parse chunks */
+			if (upng_chunk_type(chunk) == CHUNK_IDAT) {
+				memcpy(joined + compressed_index, data, length);
+				compressed_index += length;
+			} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
+				break;
+			}
 
-		/* parse chunks */
-		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			memcpy(compressed + compressed_index, data, length);
-			compressed_index += length;
-		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
-			break;
+			chunk += upng_chunk_length(chunk) + 12;
 		}
 
-		chunk += upng_chunk_length(chunk) + 12;
+		compressed = joined;
 	}
 
 	/* allocate space to store inflated (but still filtered) data */
-	inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) + upng->height;
+	inflated_size = (((upng->width * upng_get_bpp(upng) + 7) / 8) + 1) * upng->height;	/*every scanline starts with its filter type byte */
 	inflated = (unsigned char*)malloc(inflated_size);
 	if (inflated == NULL) {
-		free(compressed);
+		free(joined);
 		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
+		return NULL;
 	}
 
 	/* decompress image data */
 	error = uz_inflate(upng, inflated, inflated_size, compressed, compressed_size);
+
+	/* free the compressed compressed data */
+	free(joined);
+
 	if (error != UPNG_EOK) {
-		free(compressed);
 		free(inflated);
-		return upng->error;
+		return NULL;
 	}
 
-	/* free the compressed compressed data */
-	free(compressed);
+	return inflated;
+}
 
-	/* allocate final image buffer */
-	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
-	upng->buffer = (unsigned char*)malloc(upng->size);
-	if (upng->buffer == NULL) {
-		free(inflated);
-		upng->size = 0;
-		SET_ERROR(upng, UPNG_ENOMEM);
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+upng_error upng_decode(upng_t* upng)
+{
+	unsigned char* inflated = inflate_image_data(upng);
+	if (inflated == NULL) {
 		return upng->error;
 	}
 
-	/* unfilter scanlines */
-	post_process_scanlines(upng, upng->buffer, inflated, upng);
-	free(inflated);
+	/* unfilter scanlines, the inflated buffer becomes the final image buffer */
+	post_process_scanlines(upng, inflated, upng);
+
+	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
+	upng->buffer = inflated;
+
+	/* drop the filter type bytes left at the end, the larger buffer is kept if that fails */
+	if (upng->size > 0) {
+		unsigned char* shrunk = (unsigned char*)realloc(inflated, upng->size);
+		if (shrunk != NULL) {
+			upng->buffer = shrunk;
+		}
+	}
 
 	if (upng->error != UPNG_EOK) {
 		free(upng->buffer);
@@ -1113,6 +1393,40 @@ upng_error upng_decode(upng_t* upng)
 	return upng->error;
 }
 
+/*read a PNG into the caller's pixels, converted to 8-bit RGBA in the given output format*/
+upng_error upng_decode_into(upng_t* upng, void* pixels, unsigned long stride, upng_output_format format)
+{
+	unsigned char* inflated;
+
+	/* parse the main header, if necessary, to check the output against the image size */
+	if (upng_header(upng) != UPNG_EOK) {
+		return upng->error;
+	}
+
+	if (pixels == NULL || stride < 4 * (unsigned long)upng->width || (format != UPNG_OUTPUT_RGBA8 && format != UPNG_OUTPUT_ARGB8888)) {
+		SET_ERROR(upng, UPNG_EPARAM);
+		return upng->error;
+	}
+
+	inflated = inflate_image_data(upng);
+	if (inflated == NULL) {
+		return upng->error;
+	}
+
+	/* unfilter scanlines, converting them into the output as they are done */
+	unfilter_into(upng, (unsigned char*)pixels, stride, format, inflated);
+	free(inflated);
+
+	if (upng->error == UPNG_EOK) {
+		upng->state = UPNG_DECODED;
+	}
+
+	/* we are done with our input buffer; free it if we own it */
+	upng_free_source(upng);
+
+	return upng->error;
+}
+
 static upng_t* upng_new(void)
 {
 	upng_t* upng;
@@ -0,0 +1,239 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "matrix.h"
+
+/**
+ * Matrix module tests
+ * The batch and multiply methods (SSE2 unless built with HORENDERER_NO_SIMD) must give bit for bit
+ * the results of the scalar expressions below, including for points with w near 0 or behind the
+ * camera, and mat4_multiply_mat4() must allow its result to alias either input.
+ */
+#define NUM_RANDOM_MATRICES     64
+#define NUM_RANDOM_POINTS       4096
+
+static int failures = 0;
+static uint32_t seed = 12345;
+
+static float randomFloat(float range)
+{
+    seed = (seed * 1664525u) + 1013904223u;
+
+    return ((float)(seed >> 8) / (float)(1u << 24) * 2.0f - 1.0f) * range;
+}
+
+static mat4_t randomMatrix(void)
+{
+    mat4_t m;
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            m.m[i][j] = randomFloat(4.0f);
+        }
+    }
+
+    return m;
+}
+
+/**
+ * Bitwise equality (any NaN equals any NaN: 0/0 gives the default NaN on both paths anyway)
+ */
+static bool sameFloat(float a, float b)
+{
+    return (isnan(a) && isnan(b)) || memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+static bool sameVec3(vec3_t a, vec3_t b)
+{
+    return sameFloat(a.x, b.x) && sameFloat(a.y, b.y) && sameFloat(a.z, b.z);
+}
+
+static bool sameVec4(vec4_t a, vec4_t b)
+{
+    return sameFloat(a.x, b.x) && sameFloat(a.y, b.y) && sameFloat(a.z, b.z) && sameFloat(a.w, b.w);
+}
+
+static void check(bool ok, const char* test, int index)
+{
+    if (!ok) {
+        if (failures < 20) { fprintf(stderr, "FAILED: %s (case %d)\n", test, index); }
+        failures++;
+    }
+}
+
+/**
+ * Scalar references (same operation order as the original scalar code)
+ */
+static vec4_t referenceMultiplyVec4(const mat4_t* m, vec4_t v)
+{
+    vec4_t result;
+
+    result.x = (m->m[0][0] * v.x) + (m->m[0][1] * v.y) + (m->m[0][2] * v.z) + (m->m[0][3] * v.w);
+    result.y = (m->m[1][0] * v.x) + (m->m[1][1] * v.y) + (m->m[1][2] * v.z) + (m->m[1][3] * v.w);
+    result.z = (m->m[2][0] * v.x) + (m->m[2][1] * v.y) + (m->m[2][2] * v.z) + (m->m[2][3] * v.w);
+    result.w = (m->m[3][0] * v.x) + (m->m[3][1] * v.y) + (m->m[3][2] * v.z) + (m->m[3][3] * v.w);
+
+    return result;
+}
+
+static mat4_t referenceMultiplyMat4(const mat4_t* a, const mat4_t* b)
+{
+    mat4_t result;
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            result.m[i][j] = (a->m[i][0] * b->m[0][j]) + (a->m[i][1] * b->m[1][j]) + (a->m[i][2] * b->m[2][j]) + (a->m[i][3] * b->m[3][j]);
+        }
+    }
+
+    return result;
+}
+
+static vec4_t referenceProject(const mat4_t* m, vec3_t p, float width, float height)
+{
+    vec4_t point = referenceMultiplyVec4(m, (vec4_t){ p.x, p.y, p.z, 1.0f });
+    vec4_t result;
+
+    result.x = ((point.x / point.w) * (width / 2.0f)) + (width / 2.0f);
+    result.y = ((point.y / point.w) * -(height / 2.0f)) + (height / 2.0f);
+    result.z = point.z / point.w;
+    result.w = point.w;
+
+    return result;
+}
+
+/**
+ * Transform and project 'count' points (and the same values as directions) with 'm' and compare them with the references
+ */
+static void testPoints(const mat4_t* m, const vec3_t* points, int count, const char* name)
+{
+    static vec4_t transformed[NUM_RANDOM_POINTS];
+    static vec4_t projected[NUM_RANDOM_POINTS];
+    static vec3_t directions[NUM_RANDOM_POINTS];
+    char test[128];
+
+    mat4_transform_vec3_array(m, points, transformed, (size_t)count);
+    mat4_project_vec3_array(m, points, projected, (size_t)count, 800.0f, 600.0f);
+    mat4_transform_dir3_array(m, points, directions, (size_t)count);
+
+    for (int i = 0; i < count; i++) {
+        vec4_t expected = referenceMultiplyVec4(m, (vec4_t){ points[i].x, points[i].y, points[i].z, 1.0f });
+
+        snprintf(test, sizeof(test), "%s: mat4_transform_vec3_array", name);
+        check(sameVec4(transformed[i], expected), test, i);
+
+        snprintf(test, sizeof(test), "%s: mat4_multiply_vec4", name);
+        check(sameVec4(mat4_multiply_vec4(m, (vec4_t){ points[i].x, points[i].y, points[i].z, 1.0f }), expected), test, i);
+
+        snprintf(test, sizeof(test), "%s: mat4_project_vec3_array", name);
+        check(sameVec4(projected[i], referenceProject(m, points[i], 800.0f, 600.0f)), test, i);
+
+        vec4_t direction = referenceMultiplyVec4(m, (vec4_t){ points[i].x, points[i].y, points[i].z, 0.0f });
+
+        snprintf(test, sizeof(test), "%s: mat4_transform_dir3_array", name);
+        check(sameVec3(directions[i], (vec3_t){ direction.x, direction.y, direction.z }), test, i);
+    }
+}
+
+static void testRandomPoints(void)
+{
+    static vec3_t points[NUM_RANDOM_POINTS];
+
+    for (int i = 0; i < NUM_RANDOM_POINTS; i++) {
+        points[i] = (vec3_t){ randomFloat(10.0f), randomFloat(10.0f), randomFloat(10.0f) };
+    }
+
+    for (int i = 0; i < NUM_RANDOM_MATRICES; i++) {
+        mat4_t m = randomMatrix();
+
+        testPoints(&m, points, NUM_RANDOM_POINTS, "random matrix");
+    }
+
+    /* World and projection matrices like the pipeline builds them */
+    mat4_t rotation = mat4_make_rotation_y(0.7f);
+    mat4_t translation = mat4_make_translation(0.5f, -0.25f, 5.0f);
+    mat4_t projection = mat4_make_perspective(1.0472f, 0.75f, 0.1f, 100.0f);
+    mat4_t world;
+    mat4_t worldProjection;
+
+    mat4_multiply_mat4(&translation, &rotation, &world);
+    mat4_multiply_mat4(&projection, &world, &worldProjection);
+
+    testPoints(&world, points, NUM_RANDOM_POINTS, "world matrix");
+    testPoints(&worldProjection, points, NUM_RANDOM_POINTS, "world projection matrix");
+}
+
+/**
+ * Perspective projection: w is the z of the point, so the points below put w near 0 (both signs),
+ * at 0, below the smallest normal float and behind the camera
+ */
+static void testEdgePoints(void)
+{
+    mat4_t projection = mat4_make_perspective(1.0472f, 0.75f, 0.1f, 100.0f);
+    vec3_t points[] = {
+        { 1.0f, 1.0f, 1e-7f },
+        { 1.0f, -1.0f, -1e-7f },
+        { -3.0f, 2.0f, 1e-38f },
+        { 3.0f, -2.0f, 1e-40f },
+        { 0.0f, 0.0f, 0.0f },
+        { 1.0f, 1.0f, 0.0f },
+        { -1.0f, 0.0f, -0.0f },
+        { 2.0f, 3.0f, -5.0f },
+        { -2.0f, -3.0f, -100.0f },
+        { 1e30f, -1e30f, 1e-30f },
+        { 0.0f, 0.0f, INFINITY },
+        { 1.0f, 2.0f, NAN }
+    };
+
+    testPoints(&projection, points, (int)(sizeof(points) / sizeof(points[0])), "edge point");
+}
+
+static void testMultiplyMat4(void)
+{
+    for (int i = 0; i < NUM_RANDOM_MATRICES; i++) {
+        mat4_t a = randomMatrix();
+        mat4_t b = randomMatrix();
+        mat4_t expected = referenceMultiplyMat4(&a, &b);
+        mat4_t result;
+
+        mat4_multiply_mat4(&a, &b, &result);
+        check(memcmp(&result, &expected, sizeof(mat4_t)) == 0, "mat4_multiply_mat4", i);
+
+        /* The result may be either input */
+        mat4_t aliasA = a;
+
+        mat4_multiply_mat4(&aliasA, &b, &aliasA);
+        check(memcmp(&aliasA, &expected, sizeof(mat4_t)) == 0, "mat4_multiply_mat4(&a, &b, &a)", i);
+
+        mat4_t aliasB = b;
+
+        mat4_multiply_mat4(&a, &aliasB, &aliasB);
+        check(memcmp(&aliasB, &expected, sizeof(mat4_t)) == 0, "mat4_multiply_mat4(&a, &b, &b)", i);
+
+        /* Squaring in place aliases both inputs */
+        mat4_t square = a;
+        mat4_t expectedSquare = referenceMultiplyMat4(&a, &a);
+
+        mat4_multiply_mat4(&square, &square, &square);
+        check(memcmp(&square, &expectedSquare, sizeof(mat4_t)) == 0, "mat4_multiply_mat4(&a, &a, &a)", i);
+    }
+}
+
+int main(void)
+{
+    testRandomPoints();
+    testEdgePoints();
+    testMultiplyMat4();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d matrix checks failed\n", failures);
+        return 1;
+    }
+
+    printf("matrix tests passed\n");
+
+    return 0;
+}
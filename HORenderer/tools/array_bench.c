@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "array.h"
+#include "vector.h"
+
+/**
+ * Dynamic array push microbenchmark
+ * Times array_push() against the previous growth policy of array_hold() (a realloc to exactly the
+ * needed size on every push past the capacity) and reports the throughput in pushes per second.
+ */
+
+/**
+ * Previous array_hold(), kept here as the baseline (int header, exact-size growth)
+ */
+#define LEGACY_RAW_DATA(array)      ((int*)(array) - 2)
+#define LEGACY_CAPACITY(array)      (LEGACY_RAW_DATA(array)[0])
+#define LEGACY_OCCUPIED(array)      (LEGACY_RAW_DATA(array)[1])
+
+#define legacy_array_push(array, value)                                         \
+            do {                                                                \
+                (array) = legacy_array_hold((array), 1, sizeof(*(array)));      \
+                (array)[LEGACY_OCCUPIED(array) - 1] = (value);                  \
+            } while (0)
+
+static void* legacy_array_hold(void* array, int count, int item_size)
+{
+    if (array == NULL) {
+        int* base = (int*)malloc((sizeof(int) * 2) + (item_size * count));
+
+        if (base == NULL) { abort(); }
+
+        base[0] = count;    // capacity
+        base[1] = count;    // occupied
+
+        return base + 2;
+    } else if (LEGACY_OCCUPIED(array) + count <= LEGACY_CAPACITY(array)) {
+        LEGACY_OCCUPIED(array) += count;
+        return array;
+    } else {
+        int needed = LEGACY_OCCUPIED(array) + count;
+        int* base = (int*)realloc(LEGACY_RAW_DATA(array), (sizeof(int) * 2) + (item_size * needed));
+
+        if (base == NULL) { abort(); }
+
+        base[0] = needed;
+        base[1] = needed;
+
+        return base + 2;
+    }
+}
+
+static void legacy_array_free(void* array)
+{
+    if (array != NULL) { free(LEGACY_RAW_DATA(array)); }
+}
+
+enum {
+    POLICY_LEGACY,          // previous exact-size growth
+    POLICY_GEOMETRIC,       // array_push() from an empty array
+    POLICY_RESERVED,        // array_push() after array_reserve()
+    NUM_POLICIES
+};
+
+static const char* policyNames[NUM_POLICIES] = { "legacy", "geometric", "reserved" };
+
+static double seconds(void)
+{
+    struct timespec now;
+
+    timespec_get(&now, TIME_UTC);
+
+    return (double)now.tv_sec + ((double)now.tv_nsec * 1e-9);
+}
+
+/* Read back by every run so the pushes cannot be optimized away */
+static volatile float sink;
+
+/**
+ * Seconds to push 'count' ints with a policy
+ */
+static double pushInts(int policy, int count)
+{
+    double start = seconds();
+    int* values = NULL;
+
+    if (policy == POLICY_RESERVED) { values = (int*)array_reserve(values, (size_t)count, sizeof(int)); }
+
+    for (int i = 0; i < count; i++) {
+        if (policy == POLICY_LEGACY) {
+            legacy_array_push(values, i);
+        } else {
+            array_push(values, i);
+        }
+    }
+
+    double elapsed = seconds() - start;
+
+    sink = (float)values[count - 1];
+
+    if (policy == POLICY_LEGACY) { legacy_array_free(values); } else { array_free(values); }
+
+    return elapsed;
+}
+
+/**
+ * Seconds to push 'count' vertices (12 bytes, like the mesh loader) with a policy
+ */
+static double pushVertices(int policy, int count)
+{
+    double start = seconds();
+    vec3_t* vertices = NULL;
+
+    if (policy == POLICY_RESERVED) { vertices = (vec3_t*)array_reserve(vertices, (size_t)count, sizeof(vec3_t)); }
+
+    for (int i = 0; i < count; i++) {
+        vec3_t vertex = { (float)i, (float)i, (float)i };
+
+        if (policy == POLICY_LEGACY) {
+            legacy_array_push(vertices, vertex);
+        } else {
+            array_push(vertices, vertex);
+        }
+    }
+
+    double elapsed = seconds() - start;
+
+    sink = vertices[count - 1].x;
+
+    if (policy == POLICY_LEGACY) { legacy_array_free(vertices); } else { array_free(vertices); }
+
+    return elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int repeats = (argc > 2) ? atoi(argv[2]) : 5;
+
+    if (argc > 3 || count <= 0 || repeats <= 0) {
+        fprintf(stderr, "Usage: array_bench [pushes (default 1000000)] [repeats (default 5)]\n");
+        return 1;
+    }
+
+    printf("%d pushes per run, best of %d runs\n", count, repeats);
+    printf("%-10s %18s %18s  (Mpush/s)\n", "policy", "int", "vec3_t");
+
+    for (int policy = 0; policy < NUM_POLICIES; policy++) {
+        double bestInts = 0.0;
+        double bestVertices = 0.0;
+
+        for (int run = 0; run < repeats; run++) {
+            double ints = pushInts(policy, count);
+            double vertices = pushVertices(policy, count);
+
+            if (run == 0 || ints < bestInts) { bestInts = ints; }
+            if (run == 0 || vertices < bestVertices) { bestVertices = vertices; }
+        }
+
+        printf("%-10s %18.1f %18.1f\n", policyNames[policy], count / bestInts * 1e-6, count / bestVertices * 1e-6);
+    }
+
+    return 0;
+}
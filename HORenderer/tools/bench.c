@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "display.h"
+#include "loader.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "texture.h"
+
+/**
+ * Headless frame-time benchmark
+ * Renders frames of a mesh into an in-memory target (SDL software renderer, no window, no GPU)
+ * and reports the frame time of each pipeline stage, so regressions show up in batch jobs.
+ */
+enum {
+    STAGE_TRANSFORM,
+    STAGE_RASTER,
+    STAGE_PRESENT,
+    STAGE_TOTAL,
+    NUM_STAGES
+};
+
+static const char* stageNames[NUM_STAGES] = { "transform", "raster", "present", "total" };
+
+static const char* renderMethodNames[] = {
+    "wire", "wire-vertex", "fill", "fill-wire", "textured", "textured-wire", "overdraw"
+};
+
+static const char* filterMethodNames[] = { "nearest", "mip", "mip-bilinear" };
+
+#define NUM_RENDER_METHODS  ((int)(sizeof(renderMethodNames) / sizeof(renderMethodNames[0])))
+#define NUM_FILTER_METHODS  ((int)(sizeof(filterMethodNames) / sizeof(filterMethodNames[0])))
+
+static void printUsage(void) {
+    fprintf(stderr,
+        "Usage: bench <mesh.obj|mesh.mesh> <texture.png> [options]\n"
+        "  -w <width>       render target width (default 1280)\n"
+        "  -h <height>      render target height (default 720)\n"
+        "  -m <method>      wire, wire-vertex, fill, fill-wire, textured, textured-wire, overdraw (default textured)\n"
+        "  -n <frames>      measured frames (default 300)\n"
+        "  -W <frames>      warm-up frames, not measured (default 30)\n"
+        "  -t <threads>     rasterizer threads (default: one per CPU core)\n"
+        "  -f <filter>      nearest, mip, mip-bilinear texture filtering (default nearest)\n"
+        "  -c               disable backface culling\n"
+        "  -g               Gouraud shading (light the vertices instead of the faces)\n"
+        "  -o               rasterize the triangles front to back\n"
+        "  -p <trace.json>  profile the frames and write the last ones as a Chrome trace\n"
+        "  -s               profile the frames and print the render statistics of the last one\n");
+}
+
+static int parseName(const char* name, const char** names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) { return i; }
+    }
+
+    return -1;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Nearest-rank percentile of sorted samples
+ */
+static double percentile(const double* sorted, int count, double p) {
+    int rank = (int)((p * count) + 0.999999);
+
+    if (rank < 1) { rank = 1; }
+    if (rank > count) { rank = count; }
+
+    return sorted[rank - 1];
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printUsage();
+        return 1;
+    }
+
+    char* meshFile = argv[1];
+    char* textureFile = argv[2];
+    int width = 1280;
+    int height = 720;
+    int method = RENDER_TEXTURED;
+    int filter = FILTER_NEAREST;
+    int numFrames = 300;
+    int numWarmupFrames = 30;
+    int numThreads = 0;
+    bool cull = true;
+    bool sort = false;
+    bool gouraud = false;
+    char* traceFile = NULL;
+    bool printStats = false;
+
+    for (int i = 3; i < argc; i++) {
+        const char* option = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(option, "-c") == 0) {
+            cull = false;
+            continue;
+        }
+
+        if (strcmp(option, "-g") == 0) {
+            gouraud = true;
+            continue;
+        }
+
+        if (strcmp(option, "-o") == 0) {
+            sort = true;
+            continue;
+        }
+
+        if (strcmp(option, "-s") == 0) {
+            printStats = true;
+            continue;
+        }
+
+        if (!value || option[0] != '-' || option[1] == '\0' || option[2] != '\0') {
+            printUsage();
+            return 1;
+        }
+
+        switch (option[1]) {
+            case 'w': width = atoi(value); break;
+            case 'h': height = atoi(value); break;
+            case 'm': method = parseName(value, renderMethodNames, NUM_RENDER_METHODS); break;
+            case 'f': filter = parseName(value, filterMethodNames, NUM_FILTER_METHODS); break;
+            case 'n': numFrames = atoi(value); break;
+            case 'W': numWarmupFrames = atoi(value); break;
+            case 't': numThreads = atoi(value); break;
+            case 'p': traceFile = argv[i + 1]; break;
+            default:
+                printUsage();
+                return 1;
+        }
+
+        i++;
+    }
+
+    if (width <= 0 || height <= 0 || method < 0 || filter < 0 || numFrames <= 0 || numWarmupFrames < 0) {
+        printUsage();
+        return 1;
+    }
+
+    initializeProfiler(traceFile != NULL || printStats);
+
+    RenderMethod = (enum RenderMethod)method;
+    CullMethod = cull ? CULL_BACKFACE : CULL_NONE;
+    SortMethod = sort ? SORT_FRONT_TO_BACK : SORT_NONE;
+    ShadeMethod = gouraud ? SHADE_GOURAUD : SHADE_FLAT;
+    FilterMethod = (enum FilterMethod)filter;
+
+    bool ok = initializeOffscreen(width, height);
+
+    if (numThreads <= 0) { numThreads = SDL_GetCPUCount(); }
+
+    ok = ok && initializePipeline(numThreads);
+
+    /* The mesh and the texture load concurrently, like in the application */
+    Uint64 loadStart = SDL_GetPerformanceCounter();
+
+    ok = ok && queueAssetLoad(loadMesh, meshFile) && queueAssetLoad(load_png_texture_data, textureFile);
+    ok = ok && loadQueuedAssets(numThreads);
+
+    double loadMs = (double)(SDL_GetPerformanceCounter() - loadStart) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    double* samples[NUM_STAGES] = { NULL };
+
+    for (int stage = 0; ok && stage < NUM_STAGES; stage++) {
+        samples[stage] = (double*)malloc(sizeof(double) * numFrames);
+        ok = (samples[stage] != NULL);
+    }
+
+    if (ok) {
+        double ticksToMs = 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+        for (int frame = -numWarmupFrames; frame < numFrames; frame++) {
+            beginProfileFrame();
+
+            Uint64 start = SDL_GetPerformanceCounter();
+            transformFrame();
+            Uint64 transformed = SDL_GetPerformanceCounter();
+            rasterizeFrame();
+            Uint64 rasterized = SDL_GetPerformanceCounter();
+            presentFrame();
+            Uint64 presented = SDL_GetPerformanceCounter();
+
+            endProfileFrame();
+
+            if (frame < 0) { continue; }
+
+            samples[STAGE_TRANSFORM][frame] = (double)(transformed - start) * ticksToMs;
+            samples[STAGE_RASTER][frame] = (double)(rasterized - transformed) * ticksToMs;
+            samples[STAGE_PRESENT][frame] = (double)(presented - rasterized) * ticksToMs;
+            samples[STAGE_TOTAL][frame] = (double)(presented - start) * ticksToMs;
+        }
+
+        printf("%s: %dx%d, %s%s%s, %s filter, %d threads, %s present, %d frames (%d warm-up), %d triangles in the last frame\n",
+            meshFile, width, height, renderMethodNames[method], gouraud ? " gouraud" : "", sort ? " front to back" : "", filterMethodNames[filter], numThreads,
+            directPresent ? "direct" : "copy", numFrames, numWarmupFrames, numTrianglesToRender);
+        printf("assets loaded in %.3f ms\n", loadMs);
+        printf("render queue: %zu bytes peak, %zu bytes committed\n", renderQueueArena.peak, renderQueueArena.committed);
+        printf("%-10s %10s %10s %10s %10s  (ms)\n", "stage", "min", "mean", "p50", "p99");
+
+        for (int stage = 0; stage < NUM_STAGES; stage++) {
+            double sum = 0.0;
+
+            for (int frame = 0; frame < numFrames; frame++) {
+                sum += samples[stage][frame];
+            }
+
+            qsort(samples[stage], numFrames, sizeof(double), compareDoubles);
+
+            printf("%-10s %10.3f %10.3f %10.3f %10.3f\n", stageNames[stage],
+                samples[stage][0], sum / numFrames,
+                percentile(samples[stage], numFrames, 0.50), percentile(samples[stage], numFrames, 0.99));
+        }
+
+        const profile_frame_t* lastFrame = lastProfileFrame();
+
+        if (printStats && lastFrame) {
+            for (int counter = 0; counter < NUM_PROFILE_COUNTERS; counter++) {
+                printf("%-18s %10d\n", profileCounterName(counter), lastFrame->counters[counter]);
+            }
+        }
+
+        if (traceFile) {
+            ok = writeProfilerTrace(traceFile);
+        }
+    }
+
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+        free(samples[stage]);
+    }
+
+    destroyPipeline();
+    destroyWindow();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,28 @@
+#include <stdio.h>
+
+#include "mesh.h"
+
+/**
+ * Offline converter: OBJ file -> binary mesh file loaded by load_mesh_file()
+ */
+int main(int argc, char* argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: obj2mesh <input.obj> <output.mesh>\n");
+        return 1;
+    }
+
+    if (!load_obj_file_data(argv[1])) {
+        return 1;
+    }
+
+    bool ok = save_mesh_file(argv[2]);
+
+    if (ok) {
+        printf("%s: %d vertices, %d faces\n", argv[2], mesh.num_vertices, mesh.num_faces);
+    }
+
+    free_mesh();
+
+    return ok ? 0 : 1;
+}